@@ -38,9 +38,31 @@
 #define LASER_FIRE_SPINDLE 11 // fire the laser on M3, extinguish on M5
 
 //// Raster mode enables the laser to etch bitmap data at high speeds.  Increases command buffer size substantially.
-#define LASER_MAX_RASTER_LINE 68 // maximum number of base64 encoded pixels per raster gcode command
+//// M651 raster jobs and run-length encoded lines are planned in blocks of up to LASER_MAX_RASTER_LINE pixels,
+//// G7 D data and plain binary frames are also limited by the MAX_CMD_SIZE command buffer.
+#define LASER_MAX_RASTER_LINE 128 // maximum number of pixels (bytes when packed) per raster block. Pixels are held in the shared LASER_RASTER_BUFFER_SIZE ring, not in each block
 #define LASER_RASTER_ASPECT_RATIO 1 // pixels aren't square on most displays, 1.33 == 4:3 aspect ratio
 #define LASER_RASTER_MM_PER_PULSE 0.2 //Can be overridden by providing an R value in M649 command : M649 S17 B2 D0 R0.1 F4000
+#define LASER_RASTER_POWER_FLOOR 7 // power in percent of the faintest non-blank pixel, can be overridden with M649 T
+#define LASER_RASTER_POWER_GAMMA 1.0 // pixel to power curve, 1.0 is linear, can be overridden with M649 E
+#define LASER_RASTER_LATENCY {0, 0} // laser response lag in microseconds for raster lines travelling {left, right}, set with M650 L R and stored in EEPROM
+
+//// Blank runs at least this many pixels long in run-length encoded raster lines (G7 #) are
+//// traced as a single move with the laser off instead of as pixels.
+#define LASER_RASTER_RLE_MIN_BLANK 8
+
+//// Fire raster pixels and PULSED mode pulses from their own timer (timer 5) instead of as extra step events.
+//// The pulse clock is phase-locked to the steps, allows pulses finer than one step and leaves the stepper interrupt rate alone.
+#define LASER_PULSE_CLOCK
+
+//// Scale CONTINUOUS mode power by the step rate against the block's nominal rate, so corners the head slows
+//// into get the same energy per mm as the straights. Off at boot, switched on per job with M652 S1.
+#define LASER_VELOCITY_POWER
+#define LASER_VELOCITY_POWER_MIN 10 // lowest power in percent while slowed down, can be overridden with M652 P
+
+//// Accept raster lines as binary frames (raw pixel bytes with a CRC) as well as base64 G7 text.
+//// Saves a third of the serial bandwidth per raster line. See get_command() for the frame layout.
+#define LASER_RASTER_BINARY
 
 //// Uncomment the following if the laser cutter is equipped with a peripheral relay board
 //// to control power to an exhaust fan, water pump, laser power supply, etc.
@@ -50,7 +72,7 @@
 #define CUSTOM_MENDEL_NAME "Laser Cutter"
 #define LASER_WATTS 40.0
 #define LASER_DIAMETER 0.1 // milimeters
-#define LASER_PWM 25000 // hertz
+#define LASER_PWM 25000 // hertz, default for M653 F which is stored in EEPROM
 #define LASER_FOCAL_HEIGHT 74.50 // z axis position at which the laser is focused
 
 //===========================================================================
@@ -198,6 +220,10 @@ const bool Z_MAX_ENDSTOP_INVERTING = false; // set to true to invert the logic o
 #define DEFAULT_ZJERK                 0.4     // (mm/sec)
 #define DEFAULT_EJERK                 5.0    // (mm/sec)
 
+// Cornering by junction deviation instead of jerk: the distance in mm the path may cut a corner by at full
+// acceleration. 0.0 keeps the jerk limits above. Can be changed with M205 J and stored in EEPROM.
+#define DEFAULT_JUNCTION_DEVIATION    0.0     // (mm)
+
 //===========================================================================
 //=============================Additional Features===========================
 //===========================================================================
@@ -38,7 +38,7 @@ void _EEPROM_readData(int& pos, uint8_t* value, uint8_t size)
 // the default values are used whenever there is a change to the data, to prevent
 // wrong data being written to the variables.
 // ALSO:  always make sure the variables in the Store and retrieve sections are in the same order.
-#define EEPROM_VERSION "V11"
+#define EEPROM_VERSION "V15"
 
 #ifdef EEPROM_SETTINGS
 void Config_StoreSettings()
@@ -57,8 +57,10 @@ void Config_StoreSettings()
 	EEPROM_WRITE_VAR(i,max_xy_jerk);
 	EEPROM_WRITE_VAR(i,max_z_jerk);
 	EEPROM_WRITE_VAR(i,max_e_jerk);
+	EEPROM_WRITE_VAR(i,junction_deviation);
 	EEPROM_WRITE_VAR(i,add_homeing);
-	EEPROM_WRITE_VAR(i,laser.lifetime);
+	EEPROM_WRITE_VAR(i,laser.raster_latency);
+	EEPROM_WRITE_VAR(i,laser.pwm_frequency);
 #ifndef DOGLCD
 	int lcd_contrast = 32;
 #endif
@@ -108,13 +110,14 @@ void Config_PrintSettings()
 	SERIAL_ECHOLN("");
 
 	SERIAL_ECHO_START;
-	SERIAL_ECHOLNPGM("Advanced variables: S=Min feedrate (mm/s), T=Min travel feedrate (mm/s), B=minimum segment time (ms), X=maximum XY jerk (mm/s),  Z=maximum Z jerk (mm/s),  E=maximum E jerk (mm/s)");
+	SERIAL_ECHOLNPGM("Advanced variables: S=Min feedrate (mm/s), T=Min travel feedrate (mm/s), B=minimum segment time (ms), X=maximum XY jerk (mm/s),  Z=maximum Z jerk (mm/s),  E=maximum E jerk (mm/s),  J=junction deviation (mm), 0 for jerk");
 	SERIAL_ECHO_START;
 	SERIAL_ECHOPAIR("  M205 S",minimumfeedrate);
 	SERIAL_ECHOPAIR(" T" ,mintravelfeedrate);
 	SERIAL_ECHOPAIR(" B" ,minsegmenttime);
 	SERIAL_ECHOPAIR(" X" ,max_xy_jerk);
 	SERIAL_ECHOPAIR(" Z" ,max_z_jerk);
+	SERIAL_ECHOPAIR(" J" ,junction_deviation);
 	SERIAL_ECHOLN("");
 
 	SERIAL_ECHO_START;
@@ -131,6 +134,19 @@ void Config_PrintSettings()
 	SERIAL_ECHOLN("");
 	SERIAL_ECHOPAIR(" Minutes: ", (unsigned long) laser.lifetime % 60);
 	SERIAL_ECHOLN("");
+
+	SERIAL_ECHO_START;
+	SERIAL_ECHOLNPGM("Raster latency (us): L=lines travelling left, R=lines travelling right");
+	SERIAL_ECHO_START;
+	SERIAL_ECHOPAIR("  M650 L",(long) laser.raster_latency[0]);
+	SERIAL_ECHOPAIR(" R" ,(long) laser.raster_latency[1]);
+	SERIAL_ECHOLN("");
+
+	SERIAL_ECHO_START;
+	SERIAL_ECHOLNPGM("Laser PWM frequency (Hz):");
+	SERIAL_ECHO_START;
+	SERIAL_ECHOPAIR("  M653 F", laser.pwm_frequency);
+	SERIAL_ECHOLN("");
 }
 #endif
 
@@ -161,8 +177,10 @@ void Config_RetrieveSettings()
 		EEPROM_READ_VAR(i,max_xy_jerk);
 		EEPROM_READ_VAR(i,max_z_jerk);
 		EEPROM_READ_VAR(i,max_e_jerk);
+		EEPROM_READ_VAR(i,junction_deviation);
 		EEPROM_READ_VAR(i,add_homeing);
-		EEPROM_READ_VAR(i,laser.lifetime);
+		EEPROM_READ_VAR(i,laser.raster_latency);
+		EEPROM_READ_VAR(i,laser.pwm_frequency);
 #ifndef DOGLCD
 		int lcd_contrast;
 #endif
@@ -180,6 +198,31 @@ void Config_RetrieveSettings()
 	Config_PrintSettings();
 #endif
 }
+
+// Settings V11 to V13 kept the laser lifetime in minutes as an unsigned int right after add_homeing.
+// Returns it so the lifetime ring can be seeded once, or 0 if the stored settings are any other version.
+unsigned long Config_RetrieveOldLaserLifetime()
+{
+	int i=EEPROM_OFFSET;
+	char stored_ver[4];
+	EEPROM_READ_VAR(i,stored_ver);
+	if(strncmp("V11",stored_ver,3) != 0 && strncmp("V12",stored_ver,3) != 0 && strncmp("V13",stored_ver,3) != 0)
+	{
+		return 0;
+	}
+	i += sizeof(axis_steps_per_unit) + sizeof(max_feedrate) + sizeof(max_acceleration_units_per_sq_second);
+	i += sizeof(acceleration) + sizeof(retract_acceleration) + sizeof(minimumfeedrate) + sizeof(mintravelfeedrate);
+	i += sizeof(minsegmenttime) + sizeof(max_xy_jerk) + sizeof(max_z_jerk) + sizeof(max_e_jerk) + sizeof(add_homeing);
+	unsigned int lifetime;
+	EEPROM_READ_VAR(i,lifetime);
+	if(lifetime == 0xffff)
+	{
+		return 0;
+	}
+	SERIAL_ECHO_START;
+	SERIAL_ECHOLNPGM("Laser lifetime moved from the old settings");
+	return lifetime;
+}
 #endif
 
 void Config_ResetDefault()
@@ -205,7 +248,12 @@ void Config_ResetDefault()
 	max_xy_jerk=DEFAULT_XYJERK;
 	max_z_jerk=DEFAULT_ZJERK;
 	max_e_jerk=DEFAULT_EJERK;
+	junction_deviation=DEFAULT_JUNCTION_DEVIATION;
 	add_homeing[0] = add_homeing[1] = add_homeing[2] = 0;
+	int tmp4[]=LASER_RASTER_LATENCY;
+	laser.raster_latency[0] = tmp4[0];
+	laser.raster_latency[1] = tmp4[1];
+	laser.pwm_frequency = LASER_PWM;
 #ifdef DOGLCD
 	lcd_contrast = DEFAULT_LCD_CONTRAST;
 #endif
@@ -14,9 +14,11 @@ FORCE_INLINE void Config_PrintSettings() {}
 #ifdef EEPROM_SETTINGS
 void Config_StoreSettings();
 void Config_RetrieveSettings();
+unsigned long Config_RetrieveOldLaserLifetime();
 #else
 FORCE_INLINE void Config_StoreSettings() {}
 FORCE_INLINE void Config_RetrieveSettings() { Config_ResetDefault(); Config_PrintSettings(); }
+FORCE_INLINE unsigned long Config_RetrieveOldLaserLifetime() { return 0; }
 #endif
 
 #endif//CONFIG_STORE_H
@@ -111,6 +111,22 @@
 // if unwanted behavior is observed on a user's machine when running at very slow speeds.
 #define MINIMUM_PLANNER_SPEED 0.05// (mm/sec)
 
+// Do the trapezoid maths, which runs again on every lookahead pass, and the acceleration limits of each
+// block in 32 bit fixed point instead of software float. The block's length, speed and junction maths stay
+// float. Step rates, capped at 65535 steps/sec in both versions, and acceleration distances stay within
+// 1 step/sec and 2 steps of the float version, run compare_fixed_point.py for the bound. Compare the
+// blocks per second with PLANNER_BENCHMARK on your board before relying on the gain.
+//#define PLANNER_FIXED_POINT
+
+// Time the planner and report the blocks it can plan per second with M654
+//#define PLANNER_BENCHMARK
+
+// Ramp the step rate along an S-curve instead of a straight line, so the acceleration builds up and dies
+// down smoothly and doesn't set the gantry ringing. A ramp takes the same time and distance as before, so
+// the average acceleration is unchanged but the peak is 15/8 of it. Costs about 200 cycles more in the
+// stepper interrupt while accelerating or decelerating.
+//#define S_CURVE_ACCELERATION
+
 // MS1 MS2 Stepper Driver Microstepping mode table
 #define MICROSTEP1 LOW,LOW
 #define MICROSTEP2 HIGH,LOW
@@ -167,12 +183,24 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 
 // The number of linear motions that can be in the plan at any give time.
 // THE BLOCK_BUFFER_SIZE NEEDS TO BE A POWER OF 2, i.g. 8,16,32 because shifts and ors are used to do the ringbuffering.
-#if defined SDSUPPORT
+// The 8k boards have room for a deeper lookahead, which needs fewer forced decelerations on segment-dense paths.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+	#define BLOCK_BUFFER_SIZE 32
+#elif defined SDSUPPORT
 	#define BLOCK_BUFFER_SIZE 16   // SD,LCD,Buttons take more memory, block buffer needs to be smaller
 #else
 	#define BLOCK_BUFFER_SIZE 16 // maximize block buffer
 #endif
 
+// The number of raster pixels that can be in the plan at any given time. Blocks only keep an index into
+// this ring, so long raster lines no longer grow every block. NEEDS TO BE A POWER OF 2 and larger than LASER_MAX_RASTER_LINE.
+// The 8k boards keep four full raster lines in the plan.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+	#define LASER_RASTER_BUFFER_SIZE 512
+#else
+	#define LASER_RASTER_BUFFER_SIZE 256
+#endif
+
 
 //The ASCII buffer for recieving from the serial:
 #define MAX_CMD_SIZE 96
@@ -132,6 +132,8 @@ bool IsStopped();
 void enquecommand(const char* cmd);    //put an ascii command at the end of the current buffer.
 void enquecommand_P(const char* cmd);    //put an ascii command at the end of the current buffer, read from flash
 void prepare_arc_move(char isclockwise);
+void prepare_raster_move();
+void prepare_raster_rle_move(unsigned char* runs, int length);
 void clamp_to_software_endstops(float target[3]);
 
 #ifndef CRITICAL_SECTION_START
@@ -40,6 +40,10 @@
 #include "pins_arduino.h"
 #include "Base64.h"
 
+#ifdef LASER_RASTER_BINARY
+	#include <util/crc16.h>
+#endif
+
 #if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
 	#include <SPI.h>
 #endif
@@ -52,10 +56,11 @@
 //Implemented Codes
 //-------------------
 // G0  -> G1
-// G1  - Coordinated Movement X Y Z E
+// G1  - Coordinated Movement X Y Z E, S sets the laser power for this and the following moves
 // G2  - CW ARC
 // G3  - CCW ARC
 // G4  - Dwell S<seconds> or P<milliseconds>
+// G7  - Raster line L<raw length> $<direction> D<base64 pixels> or #<base64 run-length pixels>
 // G28 - Home all Axis
 // G90 - Use Absolute Coordinates
 // G91 - Use Relative Coordinates
@@ -97,7 +102,7 @@
 // M202 - Set max acceleration in units/s^2 for travel moves (M202 X1000 Y1000) Unused in Marlin!!	(****REALLY?****)
 // M203 - Set maximum feedrate that your machine can sustain (M203 X200 Y200 Z300 E10000) in mm/sec	(****DELETE****)
 // M204 - Set default acceleration: S normal moves T filament only moves (M204 S3000 T7000) im mm/sec^2  also sets minimum segment time in ms (B20000) to prevent buffer underruns and M20 minimum feedrate (****REALLY?****)
-// M205 -  advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, E=maximum E jerk		(****REALLY?****)
+// M205 -  advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, E=maximum E jerk, J=junction deviation in mm (0 corners by jerk)		(****REALLY?****)
 // M206 - set additional homeing offset
 // M220 S<factor in percent>- set speed factor override percentage
 // M221 S<factor in percent>- set extrude factor override percentage				(****REPURPOSE FOR LASER SCALE?****)
@@ -109,8 +114,12 @@
 // M502 - reverts to the default "factory settings".  You still need to store them in EEPROM afterwards if you want to.
 // M503 - print the current settings (from memory not from eeprom)
 // M540 - Use S[0|1] to enable or disable the stop SD card print on endstop hit (requires ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED)
-// M649 -
-// M650 -
+// M649 - set laser options S<raster power> L<duration> P<ppm> B<mode> R<mm per pulse> T<raster power floor> E<raster gamma> F<feedrate>
+// M651 - Engrave a raster job file from SD (M651 filename.rj), see Raster job files below
+// M650 - set raster latency compensation L<microseconds for lines travelling left> R<microseconds for lines travelling right>
+// M652 - set velocity proportional power S<0 off, 1 on> P<minimum power in percent>
+// M653 - set laser PWM frequency F<hertz>
+// M654 - report planner blocks per second, R resets the count (PLANNER_BENCHMARK)
 // M666 - set delta endstop adjustemnt
 // M907 - Set digital trimpot motor current using axis codes.		(####WHAT DOES THIS DO?####)
 // M908 - Control digital trimpot directly.				(####WHAT DOES THIS DO?####)
@@ -119,6 +128,24 @@
 // M928 - Start SD logging (M928 filename.g) - ended by M29
 // M999 - Restart after being stopped by error
 
+// Binary raster frames (LASER_RASTER_BINARY)
+//  A raster line may also be sent as a binary frame instead of a G7 command. Frames are recognised by
+//  LASER_RASTER_FRAME_START at the start of a line and carry no line number or checksum word:
+//    0xFE, flags, sequence, pixel count, pixels..., CRC-16/XMODEM (high byte, low byte) over flags to pixels
+//  flags bit 0 is the raster direction, bit 1 starts a new line (the G7 $ word), bit 2 marks the pixels
+//  as run-length encoded (count, power) pairs like the G7 # word, bit 3 as packed on/off pixels like the
+//  G7 ! word, in which case the count is in bytes. The count is at most LASER_MAX_RASTER_LINE and the
+//  header and pixels must fit in MAX_CMD_SIZE. The sequence counts frames modulo 256 from 0 and
+//  restarts at 0 on M110. Each frame is answered with "ok" like a G-code. A CRC failure or a frame
+//  out of sequence is answered with "Resend frame: <sequence>". Input is then dropped, never run as
+//  G-code, until that frame arrives or a line with M110 resynchronises.
+
+// Raster job files (SDSUPPORT)
+//  M651 engraves a raster job file from SD without going through the command buffer or G-code parser.
+//  The file starts with a laser_raster_job_t header (see laser.h), then an optional 256 byte power map,
+//  then rows * row_bytes bytes of raw pixels. Rows are stored in the order they are engraved, the same
+//  as G7 data, starting at the current position. Each row after the first increments the Y axis.
+
 //Stepper Movement Variables
 
 //===========================================================================
@@ -156,6 +183,7 @@ int fanSpeed=0;
 const char axis_codes[NUM_AXIS] = {'X', 'Y', 'Z'};
 static float destination[NUM_AXIS] = {  0.0, 0.0, 0.0};
 static float offset[3] = {0.0, 0.0, 0.0};
+static float raster_latency_offset = 0.0; // X offset in mm of the raster line being engraved, see raster_latency_step()
 static bool home_all_axis = true;
 static float feedrate = 5000.0, next_feedrate, saved_feedrate;
 static long gcode_N, gcode_LastN, Stopped_gcode_LastN = 0;
@@ -172,6 +200,18 @@ static char serial_char;
 static int serial_count = 0;
 static boolean comment_mode = false;
 static char* strchr_pointer; // just a pointer to find chars in the cmd string like X, Y, Z, E, etc
+#ifdef LASER_RASTER_BINARY
+	static int raster_frame_count = -1; // bytes of a binary raster frame received after the start byte, -1 if none
+	static uint16_t raster_frame_crc;
+	static unsigned char raster_frame_seq = 0; // sequence number the next binary raster frame must carry
+	static bool raster_frame_resync = false; // a frame was rejected, input is dropped until a good frame or M110
+#endif // LASER_RASTER_BINARY
+#ifdef SDSUPPORT
+	static void start_raster_job();
+	static void raster_job_next();
+	static void end_raster_job();
+	static bool raster_job_active = false; // start_raster_job() saved settings that end_raster_job() has not put back yet
+#endif // SDSUPPORT
 
 const int sensitive_pins[] = SENSITIVE_PINS; // Sensitive pin list for M42
 
@@ -319,7 +359,7 @@ void setup()
 	SERIAL_ECHOPGM(MSG_FREE_MEMORY);
 	SERIAL_ECHO(freeMemory());
 	SERIAL_ECHOPGM(MSG_PLANNER_BUFFER_BYTES);
-	SERIAL_ECHOLN((int) sizeof(block_t) *BLOCK_BUFFER_SIZE);
+	SERIAL_ECHOLN((int)(sizeof(block_t) + sizeof(plan_block_t)) *BLOCK_BUFFER_SIZE);
 	for(int8_t i = 0; i < BUFSIZE; i++)
 	{
 		fromsd[i] = false;
@@ -342,6 +382,7 @@ void setup()
 	SET_OUTPUT(CONTROLLERFAN_PIN);    //Set pin used for driver cooling fan
 #endif
 
+	laser_init_settings();
 	laser_init();
 
 	// Start up our lcd button update interrupt
@@ -396,17 +437,123 @@ void loop()
 		buflen = (buflen-1);
 		bufindr = (bufindr + 1) %BUFSIZE;
 	}
+#ifdef SDSUPPORT
+	else if(card.sdprinting && card.rasterprinting && !IsStopped())
+	{
+		raster_job_next();
+	}
+	if(raster_job_active && (IsStopped() || !card.rasterprinting || !card.isFileOpen()))
+	{
+		// The raster job finished, failed, was stopped from the LCD, or an error stopped the machine
+		if(card.rasterprinting)
+		{
+			card.sdprinting = false;
+			card.rasterprinting = false;
+			card.closefile();
+		}
+		end_raster_job();
+	}
+#endif //SDSUPPORT
 
 	manage_inactivity();
 	checkHitEndstops();
 	lcd_update();
 }
 
+#ifdef LASER_RASTER_BINARY
+// Asks the host to send binary raster frames again, starting with the one expected next
+static void FlushSerialRequestFrameResend()
+{
+	MYSERIAL.flush();
+	raster_frame_resync = true;
+	serial_count = 0;
+	comment_mode = false;
+	SERIAL_PROTOCOLPGM("Resend frame: ");
+	SERIAL_PROTOCOLLN((int) raster_frame_seq);
+	ClearToSend();
+}
+
+// Collects one byte of a binary raster frame into cmdbuffer[bufindw]. The frame is queued like any
+// other command once its CRC has been checked.
+static void get_raster_frame(unsigned char c)
+{
+	int pos = raster_frame_count + 1; // position in the command buffer, after the start byte
+	int length = (raster_frame_count >= LASER_RASTER_FRAME_HEADER) ? (unsigned char) cmdbuffer[bufindw][3] : 0;
+
+	raster_frame_count++;
+	if(pos < LASER_RASTER_FRAME_HEADER + length)
+	{
+		raster_frame_crc = _crc_xmodem_update(raster_frame_crc, c);
+		if(pos < MAX_CMD_SIZE)
+		{ cmdbuffer[bufindw][pos] = c; }
+		return;
+	}
+	if(pos == LASER_RASTER_FRAME_HEADER + length)    // CRC high byte
+	{
+		raster_frame_crc ^= (uint16_t) c << 8;
+		return;
+	}
+
+	// CRC low byte, the frame is complete
+	raster_frame_crc ^= c;
+	raster_frame_count = -1;
+	if(raster_frame_crc != 0 || length > LASER_MAX_RASTER_LINE || LASER_RASTER_FRAME_HEADER + length > MAX_CMD_SIZE)
+	{
+		SERIAL_ERROR_START;
+		if(raster_frame_crc != 0)
+		{ SERIAL_ERRORPGM("Raster frame checksum mismatch, expected frame: "); }
+		else
+		{ SERIAL_ERRORPGM("Raster frame too long, expected frame: "); }
+		SERIAL_ERRORLN((int) raster_frame_seq);
+		FlushSerialRequestFrameResend();
+		return;
+	}
+	if((unsigned char) cmdbuffer[bufindw][2] != raster_frame_seq)
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORPGM("Raster frame out of sequence, expected frame: ");
+		SERIAL_ERRORLN((int) raster_frame_seq);
+		FlushSerialRequestFrameResend();
+		return;
+	}
+	raster_frame_seq++;
+	raster_frame_resync = false;
+#ifdef SDSUPPORT
+	if(card.saving)
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORLNPGM("Raster frames can not be written to SD");
+		return;
+	}
+#endif //SDSUPPORT
+	fromsd[bufindw] = false;
+	bufindw = (bufindw + 1) %BUFSIZE;
+	buflen += 1;
+}
+#endif // LASER_RASTER_BINARY
+
 void get_command()
 {
 	while(MYSERIAL.available() > 0  && buflen < BUFSIZE)
 	{
 		serial_char = MYSERIAL.read();
+#ifdef LASER_RASTER_BINARY
+		// While resynchronising a frame may start anywhere, the partial line before it is dropped
+		if(raster_frame_count < 0 && (serial_count == 0 || raster_frame_resync) && (unsigned char) serial_char == LASER_RASTER_FRAME_START)
+		{
+			serial_count = 0;
+			comment_mode = false;
+			cmdbuffer[bufindw][0] = serial_char;
+			raster_frame_count = 0;
+			raster_frame_crc = 0;
+			continue;
+		}
+		if(raster_frame_count >= 0)
+		{
+			get_raster_frame((unsigned char) serial_char);
+			continue;
+		}
+#endif // LASER_RASTER_BINARY
 		if(serial_char == '\n' ||
 		        serial_char == '\r' ||
 		        (serial_char == ':' && comment_mode == false) ||
@@ -418,6 +565,19 @@ void get_command()
 				return;
 			}
 			cmdbuffer[bufindw][serial_count] = 0; //terminate string
+#ifdef LASER_RASTER_BINARY
+			if(raster_frame_resync)
+			{
+				// Only M110 resynchronises from text, anything else may be the rest of a rejected frame
+				if(strstr_P(cmdbuffer[bufindw], PSTR("M110")) == NULL)
+				{
+					serial_count = 0;
+					comment_mode = false;
+					continue;
+				}
+				raster_frame_resync = false;
+			}
+#endif // LASER_RASTER_BINARY
 			if(!comment_mode)
 			{
 				comment_mode = false; //for new command
@@ -486,6 +646,9 @@ void get_command()
 						return;
 					}
 				}
+#ifdef LASER_RASTER_BINARY
+				if(strstr_P(cmdbuffer[bufindw], PSTR("M110")) != NULL) { raster_frame_seq = 0; }
+#endif // LASER_RASTER_BINARY
 				if((strchr(cmdbuffer[bufindw], 'G') != NULL))
 				{
 					strchr_pointer = strchr(cmdbuffer[bufindw], 'G');
@@ -526,7 +689,7 @@ void get_command()
 		}
 	}
 #ifdef SDSUPPORT
-	if(!card.sdprinting || serial_count!=0)
+	if(!card.sdprinting || card.rasterprinting || serial_count!=0)
 	{
 		return;
 	}
@@ -621,6 +784,7 @@ XYZ_CONSTS_FROM_CONFIG(signed char, home_dir,  HOME_DIR);
 static void axis_is_at_home(int axis)
 {
 	current_position[axis] = base_home_pos(axis) + add_homeing[axis];
+	if(axis == X_AXIS) { raster_latency_offset = 0.0; }
 	min_pos[axis] =          base_min_pos(axis) + add_homeing[axis];
 	max_pos[axis] =          base_max_pos(axis) + add_homeing[axis];
 }
@@ -673,6 +837,36 @@ void process_commands()
 	unsigned long codenum; //throw away variable
 	char* starpos = NULL;
 
+#ifdef LASER_RASTER_BINARY
+	if((unsigned char) cmdbuffer[bufindr][0] == LASER_RASTER_FRAME_START)
+	{
+		// Binary raster frame, the pixels are already raw so they only need copying
+		if(Stopped == false)    // If printer is stopped by an error raster frames are ignored like G7.
+		{
+			unsigned char flags = cmdbuffer[bufindr][1];
+			if(flags & LASER_RASTER_FRAME_NEWLINE)
+			{
+				laser.raster_direction = (flags & LASER_RASTER_FRAME_DIRECTION) != 0;
+				destination[Y_AXIS] = current_position[Y_AXIS] + (laser.raster_mm_per_pulse * laser.raster_aspect_ratio);   // increment Y axis
+			}
+			if(flags & LASER_RASTER_FRAME_RLE)
+			{
+				prepare_raster_rle_move((unsigned char*) &cmdbuffer[bufindr][LASER_RASTER_FRAME_HEADER], (unsigned char) cmdbuffer[bufindr][3]);
+			}
+			else
+			{
+				int length = (unsigned char) cmdbuffer[bufindr][3];
+				memcpy(laser.raster_data, &cmdbuffer[bufindr][LASER_RASTER_FRAME_HEADER], length);
+				laser.raster_packed = (flags & LASER_RASTER_FRAME_PACKED) != 0;
+				laser.raster_num_pixels = laser.raster_packed ? length * 8 : length;
+				prepare_raster_move();
+			}
+		}
+		ClearToSend();
+		return;
+	}
+#endif // LASER_RASTER_BINARY
+
 	if(code_seen('G'))
 	{
 		switch((int) code_value())
@@ -694,11 +888,13 @@ void process_commands()
 		// X: XPos to move to
 		// Y: YPos to move to
 		// Z: ZPos to move to
+		// S: Laser intensity % for this and the following moves, fired when the laser is on with M3
 		//////////////////////////////////////////////////////////////////////
 		case 0:
 			if(Stopped == false)
 			{
 				get_coordinates(); // For X Y Z E F
+				if(code_seen('S') && !IsStopped()) { laser.intensity = (float) code_value(); }
 				prepare_move();
 				//ClearToSend();
 				return;
@@ -837,6 +1033,8 @@ void process_commands()
 		// L: Raw length
 		// $: Increment Y axis
 		// D: BASE64 encoded raster data
+		// #: BASE64 encoded run-length raster data, (count, power) byte pairs
+		// !: BASE64 encoded packed raster data, 8 on/off pixels per byte fired at the M649 S power
 		//		???? Missing data
 		//////////////////////////////////////////////////////////////////////
 		case 7: //G7 Execute raster line
@@ -849,34 +1047,23 @@ void process_commands()
 				destination[Y_AXIS] = current_position[Y_AXIS] + (laser.raster_mm_per_pulse * laser.raster_aspect_ratio);   // increment Y axis
 			}
 			
-			if(code_seen('D')) 
-			{ laser.raster_num_pixels = base64_decode(laser.raster_data, &cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], laser.raster_raw_length); }
-			
-			if(!laser.raster_direction)
-			{
-				destination[X_AXIS] = current_position[X_AXIS] - (laser.raster_mm_per_pulse * laser.raster_num_pixels);
-#if defined( LASER_DIAGNOSTICS )
-				SERIAL_ECHO_START;
-				SERIAL_ECHOLN("Negative Raster Line");
-#endif
-			}
-			else
+			// '#' is not in the base64 alphabet, so unlike D it can't be found inside the pixel data
+			if(code_seen('#'))
 			{
-				destination[X_AXIS] = current_position[X_AXIS] + (laser.raster_mm_per_pulse * laser.raster_num_pixels);
-#if defined( LASER_DIAGNOSTICS )
-				SERIAL_ECHO_START;
-				SERIAL_ECHOLN("Positive Raster Line");
-#endif
+				unsigned char runs[MAX_CMD_SIZE * 3 / 4];
+				int run_length = base64_decode(runs, &cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], min(laser.raster_raw_length, MAX_CMD_SIZE));
+				prepare_raster_rle_move(runs, run_length);
+				break;
 			}
 
-			laser.ppm = 1 / laser.raster_mm_per_pulse; //number of pulses per millimetre
-			laser.duration = (1000000 / (feedrate / 60)) / laser.ppm;     // (1 second in microseconds / (time to move 1mm in microseconds)) / (pulses per mm) = Duration of pulse, taking into account feedrate as speed and ppm
-
-			laser.mode = RASTER;
-			laser.status = LASER_ON;
-			laser.fired = RASTER;
-			prepare_move();
-
+			// '!' is not in the base64 alphabet either
+			laser.raster_packed = code_seen('!');
+			if(laser.raster_packed)
+			{ laser.raster_num_pixels = 8 * base64_decode(laser.raster_data, &cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], laser.raster_raw_length); }
+			else if(code_seen('D')) 
+			{ laser.raster_num_pixels = base64_decode(laser.raster_data, &cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], laser.raster_raw_length); }
+			
+			prepare_raster_move();
 			break;
 
 		//////////////////////////////////////////////////////////////////////
@@ -1006,6 +1193,7 @@ void process_commands()
 				if(code_seen(axis_codes[i]))
 				{
 					current_position[i] = code_value()+add_homeing[i];
+					if(i == X_AXIS) { raster_latency_offset = 0.0; }
 					plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS]);
 				}
 			}
@@ -1060,13 +1248,11 @@ void process_commands()
 			laser.fired = LASER_FIRE_SPINDLE;
 //*=*=*=*=*=*
 			lcd_update();
-
-			prepare_move();
+			// No move is queued, the next move carries the laser state
 			break;
 		case 5:  //M5 stop firing laser
 			laser.status = LASER_OFF;
 			lcd_update();
-			prepare_move();
 			break;
 #endif // LASER_FIRE_SPINDLE
 		case 17:
@@ -1165,6 +1351,20 @@ void process_commands()
 			}
 			card.openLogFile(strchr_pointer+5);
 			break;
+		case 651: //M651 - Engrave a raster job file
+			if(card.sdprinting)
+			{
+				st_synchronize();
+				card.closefile();
+				card.sdprinting = false;
+			}
+			starpos = (strchr(strchr_pointer + 5,'*'));
+			if(starpos!=NULL)
+			{ * (starpos-1) ='\0'; }
+			card.openFile(strchr_pointer + 5,true);
+			if(card.isFileOpen())
+			{ start_raster_job(); }
+			break;
 
 #endif //SDSUPPORT
 
@@ -1390,6 +1590,7 @@ void process_commands()
 				if(code_seen('X')) { max_xy_jerk = code_value() ; }
 				if(code_seen('Z')) { max_z_jerk = code_value() ; }
 				if(code_seen('E')) { max_e_jerk = code_value() ; }
+				if(code_seen('J')) { junction_deviation = max(code_value(), 0.0); }
 			}
 			break;
 		case 206: // M206 additional homeing offset
@@ -1465,11 +1666,17 @@ void process_commands()
 		case 501: // M501 Read settings from EEPROM
 			{
 				Config_RetrieveSettings();
+				st_synchronize();    // the stored PWM frequency may differ, see M653
+				laser_extinguish();
+				laser_init_pwm();
 			}
 			break;
 		case 502: // M502 Revert to default settings
 			{
 				Config_ResetDefault();
+				st_synchronize();    // the default PWM frequency may differ, see M653
+				laser_extinguish();
+				laser_init_pwm();
 			}
 			break;
 		case 503: // M503 print settings currently in memory
@@ -1491,6 +1698,17 @@ void process_commands()
 				{
 					laser.intensity = (float) code_value();
 					laser.rasterlaserpower =  laser.intensity;
+					laser_update_raster_power_map();
+				}
+				if(code_seen('T') && !IsStopped())
+				{
+					laser.raster_power_floor = (float) code_value();
+					laser_update_raster_power_map();
+				}
+				if(code_seen('E') && !IsStopped() && code_value() > 0)
+				{
+					laser.raster_power_gamma = (float) code_value();
+					laser_update_raster_power_map();
 				}
 				if(code_seen('L') && !IsStopped()) { laser.duration = (unsigned long) labs(code_value()); }
 				if(code_seen('P') && !IsStopped()) { laser.ppm = (float) code_value(); }
@@ -1505,6 +1723,59 @@ void process_commands()
 			}
 			break;
 
+		case 650: // M650 set raster latency compensation
+			{
+				if(code_seen('L')) { laser.raster_latency[0] = (int) code_value(); }
+				if(code_seen('R')) { laser.raster_latency[1] = (int) code_value(); }
+			}
+			break;
+
+#ifdef LASER_VELOCITY_POWER
+		case 652: // M652 set velocity proportional power for CONTINUOUS mode
+			{
+				if(code_seen('S')) { laser.velocity_power = code_value() != 0; }
+				if(code_seen('P')) { laser.velocity_min_power = constrain((int) code_value(), 0, 100); }
+			}
+			break;
+#endif
+
+		case 653: // M653 set laser PWM frequency
+			{
+				if(code_seen('F') && code_value() > 0)
+				{
+					st_synchronize();    // queued blocks hold compare values for the old PWM period
+					laser_extinguish();
+					laser.pwm_frequency = (unsigned long) code_value();
+					laser_init_pwm();
+				}
+				SERIAL_ECHO_START;
+				SERIAL_ECHOPAIR("Laser PWM frequency: ", laser.pwm_frequency);
+				SERIAL_ECHOPAIR(" Hz, achieved: ", laser_pwm_hertz());
+				SERIAL_ECHOPAIR(" Hz, steps: ", (unsigned long) laser.pwm_top);
+				SERIAL_ECHOLN("");
+			}
+			break;
+
+#ifdef PLANNER_BENCHMARK
+		case 654: // M654 report planner benchmark
+			{
+				SERIAL_ECHO_START;
+				SERIAL_ECHOPAIR("Planned blocks: ", planner_benchmark_blocks);
+				if(planner_benchmark_time != 0)
+				{
+					SERIAL_ECHOPAIR(" us per block: ", planner_benchmark_time / planner_benchmark_blocks);
+					SERIAL_ECHOPAIR(" blocks per second: ", planner_benchmark_blocks * 1000000.0 / planner_benchmark_time);
+				}
+				SERIAL_ECHOLN("");
+				if(code_seen('R'))
+				{
+					planner_benchmark_time = 0;
+					planner_benchmark_blocks = 0;
+				}
+			}
+			break;
+#endif
+
 		case 907: // M907 Set digital trimpot motor current using axis codes.
 			{
 #if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
@@ -1593,6 +1864,8 @@ void ClearToSend()
 void get_coordinates()
 {
 	bool seen[4]= {false,false,false,false};
+	// Moves are given in the unshifted coordinates, so they also take out the raster latency offset
+	current_position[X_AXIS] -= raster_latency_offset;
 	for(int8_t i=0; i < NUM_AXIS; i++)
 	{
 		if(code_seen(axis_codes[i]))
@@ -1605,6 +1878,8 @@ void get_coordinates()
 			destination[i] = current_position[i]; 
 		}
 	}
+	current_position[X_AXIS] += raster_latency_offset;
+	raster_latency_offset = 0.0;
 
 	if(code_seen('F'))
 	{
@@ -1681,6 +1956,307 @@ void prepare_move()
 	}
 }
 
+// Fires raster lines ahead by the laser response lag of their direction (M650). The lit part of every line
+// is engraved shifted back along X by the distance covered in that time. Pieces of the same line share the
+// offset, so no pixels are lost at block boundaries. Returns how far X has to move to reach the offset of
+// the current line, which the caller folds into its next laser-off move.
+static float raster_latency_step()
+{
+	float shift = laser.raster_latency[laser.raster_direction] * 0.000001 * feedrate * feedmultiply / 60 / 100.0;
+	float target_offset = laser.raster_direction ? -shift : shift;
+	float step = target_offset - raster_latency_offset;
+
+	raster_latency_offset = target_offset;
+	return step;
+}
+
+// Moves to the latency offset of the current line with the laser off, unless a leading travel move already did.
+static void prepare_raster_latency_offset()
+{
+	float step = raster_latency_step();
+
+	if(step != 0.0)
+	{
+		destination[X_AXIS] = current_position[X_AXIS] + step;
+		laser.mode = CONTINUOUS;
+		laser.status = LASER_OFF;
+		prepare_move();
+	}
+}
+
+// Crosses the next pixels of a raster line with the laser off, at the M205 T travel speed
+// or the engraving feedrate if that is faster.
+static void prepare_raster_travel_move(int pixels)
+{
+	float engrave_feedrate = feedrate;
+	float span = laser.raster_mm_per_pulse * pixels;
+
+	destination[X_AXIS] = current_position[X_AXIS] + (laser.raster_direction ? span : -span) + raster_latency_step();
+	laser.mode = CONTINUOUS;
+	laser.status = LASER_OFF;
+	feedrate = max(engrave_feedrate, mintravelfeedrate * 60);
+	prepare_move();
+	feedrate = engrave_feedrate;
+}
+
+// Plans a raster line across the laser.raster_num_pixels pixels in laser.raster_data, in the
+// current laser.raster_direction. Used by G7 and binary raster frames.
+// When the travel speed (M205 T) is faster than the engraving feedrate, blank pixels at either
+// end of the line are crossed at travel speed. Enough blank overscan is kept next to the lit
+// pixels to get from a standstill to engraving speed, so the planner's junction limits never
+// fall on a lit pixel. Packed lines are trimmed a whole byte of 8 pixels at a time.
+void prepare_raster_move()
+{
+	int pixels_per_byte = laser.raster_packed ? 8 : 1;
+	int bytes = (laser.raster_num_pixels + pixels_per_byte - 1) / pixels_per_byte;
+	int first = 0;
+	int last = bytes;
+
+	if(mintravelfeedrate * 60 > feedrate)
+	{
+		float speed = feedrate / 60;
+		int overscan = ceil(((speed * speed) / (2 * acceleration)) / (laser.raster_mm_per_pulse * pixels_per_byte));
+
+		while(first < last && laser.raster_data[first] == 0) { first++; }
+		while(last > first && laser.raster_data[last - 1] == 0) { last--; }
+
+		if(first == last)
+		{
+			prepare_raster_travel_move(laser.raster_num_pixels);
+			laser.mode = RASTER;
+			laser.status = LASER_ON;
+			return;
+		}
+
+		first = max(first - overscan, 0);
+		last = min(last + overscan, bytes);
+		if(first > 0)
+		{
+			prepare_raster_travel_move(first * pixels_per_byte);
+			memmove(laser.raster_data, &laser.raster_data[first], last - first);
+		}
+	}
+
+	int end = min(last * pixels_per_byte, laser.raster_num_pixels);
+	int trailing = laser.raster_num_pixels - end;
+	laser.raster_num_pixels = end - first * pixels_per_byte;
+
+	prepare_raster_latency_offset();
+
+	if(!laser.raster_direction)
+	{
+		destination[X_AXIS] = current_position[X_AXIS] - (laser.raster_mm_per_pulse * laser.raster_num_pixels);
+#if defined( LASER_DIAGNOSTICS )
+		SERIAL_ECHO_START;
+		SERIAL_ECHOLN("Negative Raster Line");
+#endif
+	}
+	else
+	{
+		destination[X_AXIS] = current_position[X_AXIS] + (laser.raster_mm_per_pulse * laser.raster_num_pixels);
+#if defined( LASER_DIAGNOSTICS )
+		SERIAL_ECHO_START;
+		SERIAL_ECHOLN("Positive Raster Line");
+#endif
+	}
+
+	laser.ppm = 1 / laser.raster_mm_per_pulse; //number of pulses per millimetre
+	laser.duration = (1000000 / (feedrate / 60)) / laser.ppm;     // (1 second in microseconds / (time to move 1mm in microseconds)) / (pulses per mm) = Duration of pulse, taking into account feedrate as speed and ppm
+
+	laser.mode = RASTER;
+	laser.status = LASER_ON;
+	laser.fired = RASTER;
+	prepare_move();
+
+	if(trailing > 0)
+	{
+		prepare_raster_travel_move(trailing);
+		laser.mode = RASTER;
+		laser.status = LASER_ON;
+	}
+}
+
+// Expands run-length encoded raster data, given as (count, power) byte pairs, while planning it.
+// Pixels are gathered into laser.raster_data and planned as raster lines of up to LASER_MAX_RASTER_LINE
+// pixels. Blank runs of LASER_RASTER_RLE_MIN_BLANK pixels or more are crossed as one laser-off travel
+// move, so they need neither pixel data nor laser pulses.
+void prepare_raster_rle_move(unsigned char* runs, int length)
+{
+	int pixels = 0;
+	uint8_t mode = laser.mode;
+	bool status = laser.status;
+
+	laser.raster_packed = false;
+
+	for(int i = 0; i + 1 < length; i += 2)
+	{
+		unsigned char count = runs[i];
+		unsigned char power = runs[i + 1];
+
+		if(power == 0 && count >= LASER_RASTER_RLE_MIN_BLANK)
+		{
+			if(pixels > 0)
+			{
+				laser.raster_num_pixels = pixels;
+				prepare_raster_move();
+				pixels = 0;
+			}
+
+			prepare_raster_travel_move(count);
+			continue;
+		}
+
+		while(count--)
+		{
+			laser.raster_data[pixels++] = power;
+			if(pixels == LASER_MAX_RASTER_LINE)
+			{
+				laser.raster_num_pixels = pixels;
+				prepare_raster_move();
+				pixels = 0;
+			}
+		}
+	}
+
+	if(pixels > 0)
+	{
+		laser.raster_num_pixels = pixels;
+		prepare_raster_move();
+	}
+	laser.mode = mode;
+	laser.status = status;
+}
+
+#ifdef SDSUPPORT
+static laser_raster_job_t raster_job;
+static uint16_t raster_job_row; // Row being engraved
+static uint16_t raster_job_offset; // Bytes of the row already planned
+static float raster_job_start_x; // X every row starts at when the job is not bidirectional
+static float raster_job_saved_feedrate;
+static float raster_job_saved_intensity;
+static unsigned char raster_job_saved_power;
+static float raster_job_saved_mm_per_pulse;
+static float raster_job_saved_aspect_ratio;
+static bool raster_job_saved_packed;
+static bool raster_job_saved_direction;
+
+// Reads the header of the raster job file just opened and starts engraving it
+static void start_raster_job()
+{
+	end_raster_job();
+	raster_job_saved_feedrate = feedrate;
+	raster_job_saved_intensity = laser.intensity;
+	raster_job_saved_power = laser.rasterlaserpower;
+	raster_job_saved_mm_per_pulse = laser.raster_mm_per_pulse;
+	raster_job_saved_aspect_ratio = laser.raster_aspect_ratio;
+	raster_job_saved_packed = laser.raster_packed;
+	raster_job_saved_direction = laser.raster_direction;
+	raster_job_active = true;
+
+	if(card.read(&raster_job, sizeof(raster_job)) != sizeof(raster_job) || strncmp(raster_job.magic, LASER_RASTER_JOB_MAGIC, 4) != 0 || raster_job.dpi == 0)
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORLNPGM("Not a raster job file");
+		card.closefile();
+		end_raster_job();
+		return;
+	}
+
+	laser.rasterlaserpower = raster_job.power;
+	laser_update_raster_power_map();
+	if((raster_job.flags & LASER_RASTER_JOB_POWER_MAP) && card.read(laser.raster_power_map, sizeof(laser.raster_power_map)) != sizeof(laser.raster_power_map))
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORLNPGM("Raster job power map missing");
+		card.closefile();
+		end_raster_job();
+		return;
+	}
+
+	laser.intensity = raster_job.power;
+	laser.raster_mm_per_pulse = 25.4 / raster_job.dpi;
+	laser.raster_aspect_ratio = 1;
+	laser.raster_packed = (raster_job.flags & LASER_RASTER_JOB_PACKED) != 0;
+	laser.raster_direction = 1;
+	if(raster_job.feedrate > 0) { feedrate = raster_job.feedrate; }
+	raster_job_row = 0;
+	raster_job_offset = 0;
+	raster_job_start_x = current_position[X_AXIS] - raster_latency_offset;
+
+	card.rasterprinting = true;
+	card.startFileprint();
+	starttime = millis();
+}
+
+// Plans the next LASER_MAX_RASTER_LINE bytes of the raster job, straight from the file into
+// laser.raster_data. Called from loop() whenever no command is waiting, the planner throttles it.
+static void raster_job_next()
+{
+	if(raster_job_row >= raster_job.rows)
+	{
+		SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
+		stoptime = millis();
+		card.printingHasFinished();
+		return;
+	}
+
+	if(raster_job_offset == 0 && raster_job_row > 0)
+	{
+		destination[Y_AXIS] = current_position[Y_AXIS] + (laser.raster_mm_per_pulse * laser.raster_aspect_ratio);   // increment Y axis
+		if(raster_job.flags & LASER_RASTER_JOB_BIDIRECTIONAL)
+		{ laser.raster_direction = !laser.raster_direction; }
+		else
+		{
+			// Go back to the start of the row with the laser off, keeping the latency offset of the direction
+			float engrave_feedrate = feedrate;
+			destination[X_AXIS] = raster_job_start_x + raster_latency_offset;
+			laser.mode = CONTINUOUS;
+			laser.status = LASER_OFF;
+			feedrate = max(feedrate, mintravelfeedrate * 60);
+			prepare_move();
+			feedrate = engrave_feedrate;
+		}
+	}
+
+	int length = min(raster_job.row_bytes - raster_job_offset, LASER_MAX_RASTER_LINE);
+	if(card.read(laser.raster_data, length) != length)
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORLNPGM("Raster job file ended early");
+		card.printingHasFinished();
+		return;
+	}
+	laser.raster_num_pixels = laser.raster_packed ? length * 8 : length;
+	prepare_raster_move();
+
+	raster_job_offset += length;
+	if(raster_job_offset >= raster_job.row_bytes)
+	{
+		raster_job_offset = 0;
+		raster_job_row++;
+	}
+}
+
+// Puts back the settings and power map start_raster_job() changed, however the job ended. The laser is
+// left off in CONTINUOUS mode, so the next G1 from the host does not fire the job's raster data.
+static void end_raster_job()
+{
+	if(!raster_job_active)
+	{ return; }
+	feedrate = raster_job_saved_feedrate;
+	laser.intensity = raster_job_saved_intensity;
+	laser.rasterlaserpower = raster_job_saved_power;
+	laser.raster_mm_per_pulse = raster_job_saved_mm_per_pulse;
+	laser.raster_aspect_ratio = raster_job_saved_aspect_ratio;
+	laser.raster_packed = raster_job_saved_packed;
+	laser.raster_direction = raster_job_saved_direction;
+	laser_update_raster_power_map();
+	laser.mode = CONTINUOUS;
+	laser.status = LASER_OFF;
+	raster_job_active = false;
+}
+#endif //SDSUPPORT
+
 void prepare_arc_move(char isclockwise)
 {
 	float r = hypot(offset[X_AXIS], offset[Y_AXIS]);    // Compute arc radius for mc_arc
@@ -1754,14 +2330,8 @@ void manage_inactivity()
 #endif
 				has_axis_homed[X_AXIS] = false;
 				has_axis_homed[Y_AXIS] = false;
-
-				if(laser.time / 60000 > 0)
-				{
-					laser.lifetime += laser.time / 60000; // convert to minutes
-					laser.time = 0;
-					Config_StoreSettings();
-				}
-				laser_init();
+				laser_extinguish();
+				laser.status = LASER_OFF;
 
 #ifdef LASER_PERIPHERALS
 				laser_peripherals_off();
@@ -1776,6 +2346,10 @@ void manage_inactivity()
 #if defined(CONTROLLERFAN_PIN) && CONTROLLERFAN_PIN > -1
 	controllerFan(); //Check if fan should be turned on to cool stepper drivers down
 #endif
+#ifdef LASER_PERIPHERALS
+	laser_manage_peripherals();
+#endif
+	laser_update_lifetime();
 
 	check_axes_activity();
 }
@@ -1788,7 +2362,8 @@ void kill()
 	disable_y();
 	disable_z();
 
-	laser_init();
+	laser_extinguish();
+	laser.status = LASER_OFF;
 
 #ifdef LASER_PERIPHERALS
 	laser_peripherals_off();
@@ -13,6 +13,7 @@ CardReader::CardReader()
 	filesize = 0;
 	sdpos = 0;
 	sdprinting = false;
+	rasterprinting = false;
 	cardOK = false;
 	saving = false;
 	logging = false;
@@ -229,6 +230,7 @@ void CardReader::openFile(char* name,bool read)
 	{ return; }
 	file.close();
 	sdprinting = false;
+	rasterprinting = false;
 
 
 	SdFile myDir;
@@ -326,6 +328,7 @@ void CardReader::removeFile(char* name)
 	{ return; }
 	file.close();
 	sdprinting = false;
+	rasterprinting = false;
 
 
 	SdFile myDir;
@@ -553,6 +556,7 @@ void CardReader::printingHasFinished()
 	quickStop();
 	file.close();
 	sdprinting = false;
+	rasterprinting = false;
 	if(SD_FINISHED_STEPPERRELEASE)
 	{
 		//finishAndDisableSteppers();
@@ -41,6 +41,7 @@ public:
 	FORCE_INLINE bool isFileOpen() { return file.isOpen(); }
 	FORCE_INLINE bool eof() { return sdpos>=filesize ;};
 	FORCE_INLINE int16_t get() {  sdpos = file.curPosition(); return (int16_t) file.read();};
+	FORCE_INLINE int16_t read(void* buf, uint16_t nbyte) { int16_t n = file.read(buf, nbyte); sdpos = file.curPosition(); return n;};
 	FORCE_INLINE void setIndex(long index) {sdpos = index; file.seekSet(index);};
 	FORCE_INLINE uint8_t percentDone() {if(!isFileOpen()) { return 0; } if(filesize) { return sdpos/ ((filesize+99) /100); } else { return 0; }};
 	FORCE_INLINE char* getWorkDirName() {workDir.getFilename(filename); return filename;};
@@ -49,6 +50,7 @@ public:
 	bool saving;
 	bool logging;
 	bool sdprinting ;
+	bool rasterprinting; // the open file is a raster job, fed to the planner by raster_job_next() rather than read as G-code
 	bool cardOK ;
 	char filename[13];
 	char longFilename[LONG_FILENAME_LENGTH];
@@ -0,0 +1,129 @@
+#!/usr/bin/env python
+
+""" Compare the planned time of a G-code file when cornering by jerk and by junction deviation (M205 J). """
+
+from __future__ import print_function
+
+import argparse
+import math
+import re
+
+__license__ = "GPL"
+
+parser = argparse.ArgumentParser(description=__doc__)
+parser.add_argument('gcode', help='G-code file to plan')
+parser.add_argument('-a', '--acceleration', type=float, default=5000.0, help='acceleration in mm/s^2 (default=5000, DEFAULT_ACCELERATION)')
+parser.add_argument('-x', '--max-acceleration', type=float, default=2600.0, help='X and Y maximum acceleration in mm/s^2 (default=2600, DEFAULT_MAX_ACCELERATION)')
+parser.add_argument('-f', '--max-feedrate', type=float, default=5000.0, help='X and Y maximum feedrate in mm/s (default=5000, DEFAULT_MAX_FEEDRATE)')
+parser.add_argument('-j', '--jerk', type=float, default=20.0, help='maximum XY jerk in mm/s (default=20, DEFAULT_XYJERK)')
+parser.add_argument('-d', '--junction-deviation', type=float, default=0.05, help='junction deviation in mm (default=0.05)')
+parser.add_argument('-m', '--minimum-speed', type=float, default=0.05, help='minimum planner speed in mm/s (default=0.05, MINIMUM_PLANNER_SPEED)')
+args = parser.parse_args()
+
+WORD = re.compile(r'([A-Z])\s*(-?[0-9.]+)')
+
+
+def read_moves(path):
+    """ Returns the X/Y moves of the file as (dx, dy, feedrate in mm/s) tuples. """
+    moves = []
+    position = [0.0, 0.0]
+    feedrate = 1500.0
+    relative = False
+    for line in open(path):
+        line = line.split(';')[0].upper()
+        words = dict(WORD.findall(line))
+        if 'G' not in words:
+            continue
+        g = int(float(words['G']))
+        if g == 90:
+            relative = False
+        elif g == 91:
+            relative = True
+        elif g == 92:
+            for i, axis in enumerate('XY'):
+                if axis in words:
+                    position[i] = float(words[axis])
+        elif g in (0, 1):
+            if 'F' in words:
+                feedrate = float(words['F'])
+            target = list(position)
+            for i, axis in enumerate('XY'):
+                if axis in words:
+                    target[i] = float(words[axis]) + (position[i] if relative else 0.0)
+            delta = (target[0] - position[0], target[1] - position[1])
+            if delta != (0.0, 0.0):
+                moves.append((delta[0], delta[1], feedrate / 60.0))
+            position = target
+    return moves
+
+
+def plan(moves, junction_deviation):
+    """ Returns the total time in seconds of the moves, planned like plan_buffer_line() with a full buffer. """
+    blocks = []
+    previous = None
+    for dx, dy, feedrate in moves:
+        length = math.hypot(dx, dy)
+        unit = (dx / length, dy / length)
+        speed = feedrate
+        for u in unit:
+            if abs(u) * speed > args.max_feedrate:
+                speed = args.max_feedrate / abs(u)
+        acceleration = args.acceleration
+        for u in unit:
+            if abs(u) * acceleration > args.max_acceleration:
+                acceleration = args.max_acceleration / abs(u)
+        current_speed = (unit[0] * speed, unit[1] * speed)
+
+        vmax_junction = min(args.jerk / 2, speed)
+        if previous is not None:
+            if junction_deviation > 0.0:
+                cos_theta = -previous['unit'][0] * unit[0] - previous['unit'][1] * unit[1]
+                if cos_theta < 0.95:
+                    vmax_junction = min(previous['speed'], speed)
+                    if cos_theta > -0.95:
+                        sin_theta_d2 = math.sqrt(0.5 * (1.0 - cos_theta))
+                        vmax_junction = min(vmax_junction, math.sqrt(acceleration * junction_deviation * sin_theta_d2 / (1.0 - sin_theta_d2)))
+            else:
+                jerk = math.hypot(current_speed[0] - previous['current_speed'][0], current_speed[1] - previous['current_speed'][1])
+                factor = args.jerk / jerk if jerk > args.jerk else 1.0
+                vmax_junction = min(previous['speed'], speed * factor)
+        block = {'length': length, 'unit': unit, 'speed': speed, 'current_speed': current_speed,
+                 'acceleration': acceleration, 'entry': vmax_junction}
+        blocks.append(block)
+        previous = block
+
+    # Reverse pass, then forward pass, as planner_recalculate() does over the whole buffer
+    exit_speed = args.minimum_speed
+    for block in reversed(blocks):
+        block['entry'] = min(block['entry'], math.sqrt(exit_speed ** 2 + 2 * block['acceleration'] * block['length']))
+        exit_speed = block['entry']
+    for block, following in zip(blocks, blocks[1:]):
+        following['entry'] = min(following['entry'], math.sqrt(block['entry'] ** 2 + 2 * block['acceleration'] * block['length']))
+
+    total = 0.0
+    for i, block in enumerate(blocks):
+        entry = block['entry']
+        exit = blocks[i + 1]['entry'] if i + 1 < len(blocks) else args.minimum_speed
+        total += trapezoid_time(entry, block['speed'], exit, block['acceleration'], block['length'])
+    return total
+
+
+def trapezoid_time(entry, nominal, exit, acceleration, length):
+    accelerate = (nominal ** 2 - entry ** 2) / (2 * acceleration)
+    decelerate = (nominal ** 2 - exit ** 2) / (2 * acceleration)
+    if accelerate + decelerate > length:
+        # Triangle: the nominal speed is never reached
+        accelerate = max(0.0, min(length, (2 * acceleration * length + exit ** 2 - entry ** 2) / (4 * acceleration)))
+        peak = math.sqrt(entry ** 2 + 2 * acceleration * accelerate)
+        return (peak - entry) / acceleration + (peak - exit) / acceleration
+    cruise = length - accelerate - decelerate
+    return (nominal - entry) / acceleration + cruise / nominal + (nominal - exit) / acceleration
+
+
+moves = read_moves(args.gcode)
+jerk_time = plan(moves, 0.0)
+deviation_time = plan(moves, args.junction_deviation)
+print("%d moves" % len(moves))
+print("jerk %.1f mm/s:              %10.1f s" % (args.jerk, jerk_time))
+print("junction deviation %.3f mm: %10.1f s (%+.1f%%)" % (args.junction_deviation, deviation_time,
+      100.0 * (deviation_time - jerk_time) / jerk_time if jerk_time > 0 else 0.0))
@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+
+""" Compare the trapezoids calculate_trapezoid_for_block() plans with and without PLANNER_FIXED_POINT over random blocks. """
+
+from __future__ import print_function
+
+import argparse
+import math
+import random
+import struct
+
+__license__ = "GPL"
+
+parser = argparse.ArgumentParser(description=__doc__)
+parser.add_argument('-n', '--blocks', type=int, default=100000, help='number of random blocks (default=100000)')
+parser.add_argument('-s', '--steps-per-mm', type=float, default=157.4802, help='X and Y steps per mm (default=157.4802, DEFAULT_AXIS_STEPS_PER_UNIT)')
+parser.add_argument('-a', '--acceleration', type=float, default=5000.0, help='acceleration in mm/s^2 (default=5000, DEFAULT_ACCELERATION)')
+parser.add_argument('-x', '--max-acceleration', type=float, default=2600.0, help='X and Y maximum acceleration in mm/s^2 (default=2600, DEFAULT_MAX_ACCELERATION)')
+parser.add_argument('-f', '--max-feedrate', type=float, default=600.0, help='highest feedrate to try in mm/s, above 416 the 16 bit nominal_rate cap is hit (default=600)')
+parser.add_argument('-l', '--max-length', type=float, default=20.0, help='longest block to try in mm (default=20)')
+parser.add_argument('--seed', type=int, default=1, help='random seed (default=1)')
+args = parser.parse_args()
+
+
+def f32(x):
+    """ Rounds to the 32 bit float the AVR works with. """
+    return struct.unpack('f', struct.pack('f', x))[0]
+
+
+def float_trapezoid(block, entry_speed, exit_speed):
+    initial_rate = max(120, int(math.ceil(f32(block['nominal_rate'] * f32(entry_speed / block['nominal_speed'])))))
+    final_rate = max(120, int(math.ceil(f32(block['nominal_rate'] * f32(exit_speed / block['nominal_speed'])))))
+    acceleration = float(block['acceleration_st'])
+    nominal = float(block['nominal_rate'])
+
+    def estimate_acceleration_distance(initial, target, acceleration):
+        return f32(f32(f32(target * target) - f32(initial * initial)) / f32(2.0 * acceleration))
+
+    accelerate_steps = int(math.ceil(estimate_acceleration_distance(initial_rate, nominal, acceleration)))
+    decelerate_steps = int(math.floor(estimate_acceleration_distance(nominal, final_rate, -acceleration)))
+    plateau_steps = block['step_event_count'] - accelerate_steps - decelerate_steps
+    if plateau_steps < 0:
+        intersection = f32(f32(f32(f32(2.0 * acceleration) * block['step_event_count']) - f32(initial_rate * initial_rate) + f32(final_rate * final_rate)) / f32(4.0 * acceleration))
+        accelerate_steps = min(max(int(math.ceil(intersection)), 0), block['step_event_count'])
+        plateau_steps = 0
+    return initial_rate, final_rate, accelerate_steps, accelerate_steps + plateau_steps
+
+
+def multiply_high(a, b):
+    """ The high 32 bits of a * b from 16 x 16 bit products, like planner.cpp. """
+    a_high, a_low, b_high, b_low = a >> 16, a & 0xffff, b >> 16, b & 0xffff
+    middle = a_high * b_low + ((a_low * b_low) >> 16)
+    middle2 = a_low * b_high + (middle & 0xffff)
+    assert middle < 1 << 32 and middle2 < 1 << 32
+    return a_high * b_high + (middle >> 16) + (middle2 >> 16)
+
+
+def fixed_trapezoid(block, entry_speed, exit_speed):
+    nominal_rate = block['nominal_rate']
+    initial_rate = max(120, min(int(f32(entry_speed * block['steps_per_mm'])) + 1, nominal_rate))
+    final_rate = max(120, min(int(f32(exit_speed * block['steps_per_mm'])) + 1, nominal_rate))
+    inverse = block['acceleration_st_inverse']
+
+    nominal_sq = nominal_rate * nominal_rate
+    initial_sq = initial_rate * initial_rate
+    final_sq = final_rate * final_rate
+    accelerate_steps = multiply_high(nominal_sq - initial_sq, inverse) + 1 if nominal_sq > initial_sq else 0
+    decelerate_steps = multiply_high(nominal_sq - final_sq, inverse) if nominal_sq > final_sq else 0
+    plateau_steps = block['step_event_count'] - accelerate_steps - decelerate_steps
+    if plateau_steps < 0:
+        accelerate_steps = (block['step_event_count'] + 1) >> 1
+        if final_sq > initial_sq:
+            accelerate_steps += multiply_high(final_sq - initial_sq, inverse) >> 1
+        else:
+            accelerate_steps -= multiply_high(initial_sq - final_sq, inverse) >> 1
+        accelerate_steps = min(max(accelerate_steps, 0), block['step_event_count'])
+        plateau_steps = 0
+    return initial_rate, final_rate, accelerate_steps, accelerate_steps + plateau_steps
+
+
+def random_block():
+    """ Sets up an X/Y block like plan_buffer_line() does, including the 16 bit cap of nominal_rate. """
+    while True:
+        length = random.uniform(0.01, args.max_length)
+        angle = random.uniform(0.0, 2.0 * math.pi)
+        steps_x = abs(int(round(length * math.cos(angle) * args.steps_per_mm)))
+        steps_y = abs(int(round(length * math.sin(angle) * args.steps_per_mm)))
+        step_event_count = max(steps_x, steps_y)
+        if step_event_count > 0:
+            break
+    millimeters = f32(math.hypot(steps_x, steps_y) / args.steps_per_mm)
+    inverse_second = f32(random.uniform(1.0, args.max_feedrate) / millimeters)
+    steps_per_mm = f32(step_event_count / millimeters)
+    nominal_rate = int(math.ceil(f32(step_event_count * inverse_second)))
+    acceleration_st = int(math.ceil(f32(args.acceleration * steps_per_mm)))
+    axis_steps_per_sqr_second = int(args.max_acceleration * args.steps_per_mm)
+    for steps in (steps_x, steps_y):
+        if acceleration_st * steps > axis_steps_per_sqr_second * step_event_count:
+            acceleration_st = axis_steps_per_sqr_second
+    return {'step_event_count': step_event_count,
+            'nominal_speed': f32(millimeters * inverse_second),
+            'nominal_rate': min(nominal_rate, 0xffff),
+            'capped': nominal_rate > 0xffff,
+            'steps_per_mm': f32(f32(steps_per_mm * 0xffff) / nominal_rate) if nominal_rate > 0xffff else steps_per_mm,
+            'acceleration_st': acceleration_st,
+            'acceleration_st_inverse': 0x80000000 // acceleration_st}
+
+
+random.seed(args.seed)
+names = ('initial_rate', 'final_rate', 'accelerate_until', 'decelerate_after')
+worst = [0] * len(names)
+capped = 0
+for i in range(args.blocks):
+    block = random_block()
+    capped += block['capped']
+    entry_speed = f32(random.uniform(0.0, block['nominal_speed']))
+    exit_speed = f32(random.uniform(0.0, block['nominal_speed']))
+    reference = float_trapezoid(block, entry_speed, exit_speed)
+    fixed = fixed_trapezoid(block, entry_speed, exit_speed)
+    for j in range(len(names)):
+        worst[j] = max(worst[j], abs(fixed[j] - reference[j]))
+
+print("%d blocks, %d with nominal_rate capped at 65535, largest difference of the fixed point trapezoid from the float one:" % (args.blocks, capped))
+for name, difference in zip(names, worst):
+    print("  %-16s %d" % (name, difference))
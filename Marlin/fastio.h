@@ -89,6 +89,14 @@
 /// check if pin is an timer wrapper
 #define GET_TIMER(IO)  _GET_TIMER(IO)
 
+/// port registers and bit mask of a pin, for reading or writing several pins of one port at once
+#define _PIN_RPORT(IO)  DIO ## IO ## _RPORT
+#define _PIN_WPORT(IO)  DIO ## IO ## _WPORT
+#define _PIN_MASK(IO)  MASK(DIO ## IO ## _PIN)
+#define PIN_RPORT(IO)  _PIN_RPORT(IO)
+#define PIN_WPORT(IO)  _PIN_WPORT(IO)
+#define PIN_MASK(IO)  _PIN_MASK(IO)
+
 /*
 	ports and functions
 
@@ -24,8 +24,11 @@
 #include <avr/interrupt.h>
 #include <Arduino.h>
 #include "Marlin.h"
+#include "ultralcd.h"
+#include "stepper.h"
 
 laser_t laser;
+unsigned int laser_power_ocr[101];
 
 void timer3_init(int pin)
 {
@@ -34,15 +37,15 @@ void timer3_init(int pin)
 
 	TCCR3B = 0x00;  // stop Timer4 clock for register updates
 	TCCR3A = 0x82; // Clear OC3A on match, fast PWM mode, lower WGM3x=14
-	ICR3 = labs(F_CPU / LASER_PWM);    // clock cycles per PWM pulse
-	OCR3A = labs(F_CPU / LASER_PWM) - 1;    // ICR3 - 1 force immediate compare on next tick
-	TCCR3B = 0x18 | 0x01; // upper WGM4x = 14, clock sel = prescaler, start running
+	ICR3 = laser.pwm_top;    // clock cycles per PWM pulse
+	OCR3A = laser.pwm_top - 1;    // ICR3 - 1 force immediate compare on next tick
+	TCCR3B = 0x18 | laser.pwm_prescaler; // upper WGM4x = 14, clock sel = prescaler, start running
 
 	noInterrupts();
 	TCCR3B &= 0xf8; // stop timer, OC3A may be active now
-	TCNT3 = labs(F_CPU / LASER_PWM);    // force immediate compare on next tick
-	ICR3 = labs(F_CPU / LASER_PWM);    // set new PWM period
-	TCCR3B |= 0x01; // start the timer with proper prescaler value
+	TCNT3 = laser.pwm_top;    // force immediate compare on next tick
+	ICR3 = laser.pwm_top;    // set new PWM period
+	TCCR3B |= laser.pwm_prescaler; // start the timer with proper prescaler value
 	interrupts();
 }
 
@@ -53,23 +56,61 @@ void timer4_init(int pin)
 
 	TCCR4B = 0x00;  // stop Timer4 clock for register updates
 	TCCR4A = 0x82; // Clear OC4A on match, fast PWM mode, lower WGM4x=14
-	ICR4 = labs(F_CPU / LASER_PWM);    // clock cycles per PWM pulse
-	OCR4A = labs(F_CPU / LASER_PWM) - 1;    // ICR4 - 1 force immediate compare on next tick
-	TCCR4B = 0x18 | 0x01; // upper WGM4x = 14, clock sel = prescaler, start running
+	ICR4 = laser.pwm_top;    // clock cycles per PWM pulse
+	OCR4A = laser.pwm_top - 1;    // ICR4 - 1 force immediate compare on next tick
+	TCCR4B = 0x18 | laser.pwm_prescaler; // upper WGM4x = 14, clock sel = prescaler, start running
 
 	noInterrupts();
 	TCCR4B &= 0xf8; // stop timer, OC4A may be active now
-	TCNT4 = labs(F_CPU / LASER_PWM);    // force immediate compare on next tick
-	ICR4 = labs(F_CPU / LASER_PWM);    // set new PWM period
-	TCCR4B |= 0x01; // start the timer with proper prescaler value
+	TCNT4 = laser.pwm_top;    // force immediate compare on next tick
+	ICR4 = laser.pwm_top;    // set new PWM period
+	TCCR4B |= laser.pwm_prescaler; // start the timer with proper prescaler value
 	interrupts();
 }
 
-void laser_init()
+static const uint8_t prescaler_shift[] = {0, 3, 6, 8, 10};    // clock select 1 to 5: F_CPU / 1, 8, 64, 256, 1024
+
+// Programs the laser intensity timer for laser.pwm_frequency and recomputes laser_power_ocr[]. The smallest
+// prescaler that fits the PWM period into the 16 bit timer is used, for the finest power steps.
+void laser_init_pwm()
 {
+	unsigned long hertz = constrain(laser.pwm_frequency, 1, F_CPU / 100);    // at least 100 timer cycles for 1% power steps
+	unsigned long top = F_CPU / hertz;
+	uint8_t cs = 0;
+	while(cs < 4 && (top >> prescaler_shift[cs]) > 0xffff) { cs++; }
+	top >>= prescaler_shift[cs];
+	laser.pwm_top = min(top, 0xffffUL);
+	laser.pwm_prescaler = cs + 1;
+
 	// Initialize timers for laser intensity control
 	if(LASER_INTENSITY_PIN == 2 || LASER_INTENSITY_PIN == 3 || LASER_INTENSITY_PIN == 5) { timer3_init(LASER_INTENSITY_PIN); }
 	if(LASER_INTENSITY_PIN == 6 || LASER_INTENSITY_PIN == 7 || LASER_INTENSITY_PIN == 8) { timer4_init(LASER_INTENSITY_PIN); }
+	LASER_INTENSITY_TCCRA |= (1<<LASER_INTENSITY_COM);    // connect the PWM output, laser_fire_ocr() only writes the compare register
+	for(int i = 0; i <= 100; i++)
+	{
+		laser_power_ocr[i] = ((unsigned long) laser.pwm_top * i) / 100;
+	}
+}
+
+// Returns the PWM frequency laser_init_pwm() actually set, rounded by the prescaler and the whole timer
+// period. In fast PWM mode 14 the period is pwm_top + 1 timer cycles.
+unsigned long laser_pwm_hertz()
+{
+	return (F_CPU >> prescaler_shift[laser.pwm_prescaler - 1]) / ((unsigned long) laser.pwm_top + 1);
+}
+
+void laser_init()
+{
+	laser_init_pwm();
+	laser_load_lifetime();
+
+	WRITE(LASER_FIRING_PIN, HIGH);    // laser off
+	SET_OUTPUT(LASER_FIRING_PIN);
+
+	// Timer 5 runs free at 2MHz, normal mode, for laser pulse and raster pixel timing. Its interrupts are enabled as needed.
+	TIMSK5 = 0;
+	TCCR5A = 0;
+	TCCR5B = (1<<CS51);
 
 #ifdef LASER_PERIPHERALS
 	digitalWrite(LASER_PERIPHERALS_PIN, HIGH);    // Laser peripherals are active LOW, so preset the pin
@@ -77,33 +118,41 @@ void laser_init()
 
 	digitalWrite(LASER_PERIPHERALS_STATUS_PIN, HIGH);    // Set the peripherals status pin to pull-up.
 	pinMode(LASER_PERIPHERALS_STATUS_PIN, INPUT);
+	laser.peripherals_state = LASER_PERIPHERALS_OFF;
 #endif // LASER_PERIPHERALS
 
-	// initialize state to some sane defaults
+	laser.status = LASER_OFF;
+	laser.firing = LASER_OFF;
+
+	laser_extinguish();
+}
+
+// Sets the laser options M649 and friends can change to their defaults, once at boot
+void laser_init_settings()
+{
 	laser.intensity = 100.0;
 	laser.ppm = 0.0;
 	laser.duration = 0;
-	laser.status = LASER_OFF;
-	laser.firing = LASER_OFF;
 	laser.mode = CONTINUOUS;
-	laser.last_firing = 0;
-	laser.time = 0;
 	laser.raster_aspect_ratio = LASER_RASTER_ASPECT_RATIO;
 	laser.raster_mm_per_pulse = LASER_RASTER_MM_PER_PULSE;
 	laser.raster_direction = 1;
-
-	laser_extinguish();
+	laser.raster_packed = false;
+	laser.raster_power_floor = LASER_RASTER_POWER_FLOOR;
+	laser.raster_power_gamma = LASER_RASTER_POWER_GAMMA;
+	laser_update_raster_power_map();
+#ifdef LASER_VELOCITY_POWER
+	laser.velocity_power = false;
+	laser.velocity_min_power = LASER_VELOCITY_POWER_MIN;
+#endif
 }
 void laser_fire(int intensity = 100.0)
 {
-	laser.firing = LASER_ON;
-	laser.last_firing = micros(); // microseconds of last laser firing
 	if(intensity > 100.0) { intensity = 100.0; }    // restrict intensity between 0 and 100
 	if(intensity < 0) { intensity = 0; }
 
-	pinMode(LASER_FIRING_PIN, OUTPUT);
-	analogWrite(LASER_INTENSITY_PIN, labs((intensity / 100.0) * (F_CPU / LASER_PWM)));
-	WRITE(LASER_FIRING_PIN, LOW);
+	laser.dur = 0;    // Fire until laser_extinguish(), not for the pulse length of the last PULSED or raster block
+	laser_fire_ocr(laser_power_ocr[intensity]);
 
 #if defined( LASER_DIAGNOSTICS )
 	SERIAL_ECHOLN("Laser fired");
@@ -113,17 +162,33 @@ void laser_extinguish()
 {
 	if(laser.firing == LASER_ON)
 	{
+		CRITICAL_SECTION_START;
+		laser_count_on_time();
 		laser.firing = LASER_OFF;
+		CRITICAL_SECTION_END;
 
 		// Engage the pullup resistor for TTL laser controllers which don't turn off entirely without it.
 		WRITE(LASER_FIRING_PIN, HIGH);
-		laser.time += millis() - (laser.last_firing / 1000);
 
 #if defined( LASER_DIAGNOSTICS )
 		SERIAL_ECHOLN("Laser extinguished");
 #endif
 	}
 }
+// Ends a timed laser pulse, see laser_pulse_start()
+ISR(TIMER5_COMPB_vect)
+{
+	if(laser.pulse_wraps != 0)
+	{
+		laser.pulse_wraps--;
+		return;
+	}
+	TIMSK5 &= ~(1<<OCIE5B);
+#if defined( LASER_DIAGNOSTICS )
+	SERIAL_ECHOLN("Laser firing duration elapsed, in pulse timer");
+#endif
+	laser_extinguish();
+}
 void laser_set_mode(int mode)
 {
 	switch(mode)
@@ -139,14 +204,84 @@ void laser_set_mode(int mode)
 		return;
 	}
 }
+// Scale the pixel values 1-255 between the power floor and laser.rasterlaserpower. Pixel 0 turns
+// the laser off. Only needs to run when the raster power, floor or gamma change.
+void laser_update_raster_power_map()
+{
+	float range = laser.rasterlaserpower - laser.raster_power_floor;
+	laser.raster_power_map[0] = 0;
+	for(int i = 1; i < 256; i++)
+	{
+		float level = i / 255.0;
+		if(laser.raster_power_gamma != 1.0) { level = pow(level, laser.raster_power_gamma); }
+		float power = laser.raster_power_floor + level * range;
+		if(power < 0) { power = 0; }
+		if(power > 100) { power = 100; }
+		laser.raster_power_map[i] = power;
+	}
+}
+// The lifetime counter is written to the next of LASER_LIFETIME_SLOTS dwords on every minute, so each
+// EEPROM cell is written only once every LASER_LIFETIME_SLOTS minutes of firing. The largest slot is current,
+// erased slots read as 0xffffffff.
+#define LASER_LIFETIME_EEPROM_OFFSET 1024
+#define LASER_LIFETIME_SLOTS 64
+static uint8_t lifetime_slot;
+
+void laser_load_lifetime()
+{
+	bool found = false;
+	laser.lifetime = 0;
+	for(uint8_t i = 0; i < LASER_LIFETIME_SLOTS; i++)
+	{
+		unsigned long minutes = eeprom_read_dword((uint32_t*) (LASER_LIFETIME_EEPROM_OFFSET + i * 4));
+		if(minutes != 0xffffffffUL && minutes >= laser.lifetime)
+		{
+			laser.lifetime = minutes;
+			lifetime_slot = i;
+			found = true;
+		}
+	}
+	if(!found)
+	{
+		// Empty ring, seed it with the lifetime older firmware kept in the settings block
+		laser.lifetime = Config_RetrieveOldLaserLifetime();
+		lifetime_slot = 0;
+		if(laser.lifetime > 0)
+		{
+			eeprom_update_dword((uint32_t*) LASER_LIFETIME_EEPROM_OFFSET, laser.lifetime);
+		}
+	}
+}
+
+// Folds the firing time counted by the stepper into whole minutes of lifetime and stores each one.
+// Called from manage_inactivity().
+void laser_update_lifetime()
+{
+	CRITICAL_SECTION_START;
+	laser_count_on_time();
+	bool minute = laser.on_ticks >= LASER_TICKS_PER_MINUTE;
+	if(minute) { laser.on_ticks -= LASER_TICKS_PER_MINUTE; }
+	CRITICAL_SECTION_END;
+	if(minute)
+	{
+		laser.lifetime++;
+		lifetime_slot = (lifetime_slot + 1) % LASER_LIFETIME_SLOTS;
+		eeprom_update_dword((uint32_t*) (LASER_LIFETIME_EEPROM_OFFSET + lifetime_slot * 4), laser.lifetime);
+	}
+}
 #ifdef LASER_PERIPHERALS
 bool laser_peripherals_ok()
 {
 	return !digitalRead(LASER_PERIPHERALS_STATUS_PIN);
 }
+// Switches the peripherals on without waiting for them. laser_manage_peripherals() follows the status
+// signal, and the stepper holds laser blocks back until it reports them ready.
 void laser_peripherals_on()
 {
+	if(laser.peripherals_state != LASER_PERIPHERALS_OFF) { return; }
 	digitalWrite(LASER_PERIPHERALS_PIN, LOW);
+	laser.peripherals_started = millis();
+	laser.peripherals_state = LASER_PERIPHERALS_STARTING;
 #if defined( LASER_DIAGNOSTICS )
 	SERIAL_ECHO_START;
 	SERIAL_ECHOLNPGM("Laser Peripherals Enabled");
@@ -154,33 +289,44 @@ void laser_peripherals_on()
 }
 void laser_peripherals_off()
 {
-	if(!digitalRead(LASER_PERIPHERALS_STATUS_PIN))
+	if(laser.peripherals_state != LASER_PERIPHERALS_OFF)
 	{
 		digitalWrite(LASER_PERIPHERALS_PIN, HIGH);
+		laser.peripherals_state = LASER_PERIPHERALS_OFF;
 #if defined( LASER_DIAGNOSTICS )
 		SERIAL_ECHO_START;
 		SERIAL_ECHOLNPGM("Laser Peripherals Disabled");
 #endif
 	}
 }
-void laser_wait_for_peripherals()
+// Peripheral handshake, called from manage_inactivity(). Stops the machine when the peripheral control
+// board doesn't answer within LASER_PERIPHERALS_TIMEOUT or drops its status signal while running.
+void laser_manage_peripherals()
 {
-	unsigned long timeout = millis() + LASER_PERIPHERALS_TIMEOUT;
-#if defined( LASER_DIAGNOSTICS )
-	SERIAL_ECHO_START;
-	SERIAL_ECHOLNPGM("Waiting for peripheral control board signal...");
-#endif
-	while(!laser_peripherals_ok())
+	if(laser.peripherals_state == LASER_PERIPHERALS_STARTING)
 	{
-		if(millis() > timeout)
+		if(laser_peripherals_ok())
 		{
+			laser.peripherals_state = LASER_PERIPHERALS_READY;
 #if defined( LASER_DIAGNOSTICS )
+			SERIAL_ECHO_START;
+			SERIAL_ECHOLNPGM("Laser Peripherals Ready");
+#endif
+		}
+		else if(millis() - laser.peripherals_started > LASER_PERIPHERALS_TIMEOUT)
+		{
 			SERIAL_ERROR_START;
 			SERIAL_ERRORLNPGM("Peripheral control board failed to respond");
-#endif
+			quickStop();    // Drop the laser blocks the stepper is holding back
 			Stop();
-			break;
 		}
 	}
+	else if(laser.peripherals_state == LASER_PERIPHERALS_READY && !laser_peripherals_ok())
+	{
+		SERIAL_ERROR_START;
+		SERIAL_ERRORLNPGM("Peripheral control board signal lost");
+		quickStop();
+		Stop();
+	}
 }
 #endif // LASER_PERIPHERALS
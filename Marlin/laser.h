@@ -21,7 +21,7 @@
 #define LASER_H
 
 #include <inttypes.h>
-#include "Configuration.h"
+#include "Marlin.h"
 
 // split into planned and status
 typedef struct
@@ -34,31 +34,91 @@ typedef struct
 	bool status; // LASER_ON / LASER_OFF - buffered
 	bool firing; // LASER_ON / LASER_OFF - instantaneous
 	uint8_t mode; // CONTINUOUS, PULSED, RASTER
-	unsigned long last_firing; // microseconds since last laser firing
-	unsigned int time; // temporary counter to limit eeprom writes
-	unsigned int lifetime; // laser lifetime firing counter in minutes
+	volatile unsigned long on_ticks; // timer 5 ticks fired and not yet counted in lifetime, see laser_count_on_time()
+	volatile unsigned int on_mark; // TCNT5 when on_ticks was last brought up to date
+	unsigned long lifetime; // laser lifetime firing counter in minutes, kept in its own EEPROM ring by laser_update_lifetime()
 	unsigned char raster_data[LASER_MAX_RASTER_LINE];
 	unsigned char rasterlaserpower;
+	unsigned char raster_power_map[256]; // laser power for each pixel value, rebuilt by laser_update_raster_power_map()
+	float raster_power_floor; // power in percent of the faintest non-blank pixel
+	float raster_power_gamma; // pixel to power curve, 1.0 is linear
 
 	float raster_aspect_ratio;
 	float raster_mm_per_pulse;
 	int raster_raw_length;
 	int raster_num_pixels;
 	bool raster_direction;
+	bool raster_packed; // raster_data holds 8 on/off pixels per byte, most significant bit first, fired at intensity
+	int raster_latency[2]; // laser response lag in microseconds, indexed by raster_direction
+	unsigned long pwm_frequency; // laser PWM frequency in hertz, set with M653 and stored in EEPROM
+	unsigned int pwm_top; // timer clock cycles per PWM period, set by laser_init_pwm()
+	uint8_t pwm_prescaler; // timer clock select bits, set by laser_init_pwm()
+#ifdef LASER_VELOCITY_POWER
+	bool velocity_power; // scale CONTINUOUS mode power by the step rate
+	int velocity_min_power; // lowest power in percent while velocity_power scales it down
+#endif
+#ifdef LASER_PERIPHERALS
+	volatile uint8_t peripherals_state; // LASER_PERIPHERALS_OFF, LASER_PERIPHERALS_STARTING, LASER_PERIPHERALS_READY
+	unsigned long peripherals_started; // millis() when the peripherals were switched on
+#endif
+	volatile unsigned int pulse_wraps; // timer 5 overflows left before the pulse end compare match counts
 } laser_t;
 
 extern laser_t laser;
+extern unsigned int laser_power_ocr[101]; // PWM compare value for each laser power in percent
+
+// Timer compare register driving LASER_INTENSITY_PIN, so the laser can be fired with a single register write
+#if LASER_INTENSITY_PIN == 2
+	#define LASER_INTENSITY_TCCRA TCCR3A
+	#define LASER_INTENSITY_COM COM3B1
+	#define LASER_INTENSITY_OCR OCR3B
+#elif LASER_INTENSITY_PIN == 3
+	#define LASER_INTENSITY_TCCRA TCCR3A
+	#define LASER_INTENSITY_COM COM3C1
+	#define LASER_INTENSITY_OCR OCR3C
+#elif LASER_INTENSITY_PIN == 5
+	#define LASER_INTENSITY_TCCRA TCCR3A
+	#define LASER_INTENSITY_COM COM3A1
+	#define LASER_INTENSITY_OCR OCR3A
+#elif LASER_INTENSITY_PIN == 6
+	#define LASER_INTENSITY_TCCRA TCCR4A
+	#define LASER_INTENSITY_COM COM4A1
+	#define LASER_INTENSITY_OCR OCR4A
+#elif LASER_INTENSITY_PIN == 7
+	#define LASER_INTENSITY_TCCRA TCCR4A
+	#define LASER_INTENSITY_COM COM4B1
+	#define LASER_INTENSITY_OCR OCR4B
+#elif LASER_INTENSITY_PIN == 8
+	#define LASER_INTENSITY_TCCRA TCCR4A
+	#define LASER_INTENSITY_COM COM4C1
+	#define LASER_INTENSITY_OCR OCR4C
+#else
+	#error LASER_INTENSITY_PIN must be one of the timer 3 or 4 PWM pins 2, 3, 5, 6, 7 or 8
+#endif
+
+// Timer 5 runs free at 2MHz for laser timing. Compare A is the pulse clock for raster pixels and PULSED mode (see stepper.cpp),
+// compare B ends timed laser pulses so they don't have to be polled for.
+#define LASER_TIMER_TICKS_PER_US (F_CPU / 8000000)
 
 void laser_init();
+void laser_init_settings();
+void laser_init_pwm();
+unsigned long laser_pwm_hertz();
 void laser_fire(int intensity);
 void laser_extinguish();
+void laser_load_lifetime();
 void laser_update_lifetime();
 void laser_set_mode(int mode);
+void laser_update_raster_power_map();
 #ifdef LASER_PERIPHERALS
 	bool laser_peripherals_ok();
 	void laser_peripherals_on();
 	void laser_peripherals_off();
-	void laser_wait_for_peripherals();
+	void laser_manage_peripherals();
+
+	#define LASER_PERIPHERALS_OFF 0
+	#define LASER_PERIPHERALS_STARTING 1 // switched on, waiting for the status signal
+	#define LASER_PERIPHERALS_READY 2
 #endif // LASER_PERIPHERALS
 
 // Laser constants
@@ -69,4 +129,67 @@ void laser_set_mode(int mode);
 #define PULSED 1
 #define RASTER 2
 
+// Arms timer 5 compare B to extinguish the laser laser.dur microseconds from now. Pulses longer than
+// one timer 5 period (32ms) let the compare match pass by once for every overflow.
+FORCE_INLINE void laser_pulse_start()
+{
+	unsigned long ticks = max(laser.dur * LASER_TIMER_TICKS_PER_US, 4UL);
+	OCR5B = TCNT5 + (unsigned int) ticks;
+	laser.pulse_wraps = ticks >> 16;
+	TIFR5 = (1<<OCF5B);
+	TIMSK5 |= (1<<OCIE5B);
+}
+
+#define LASER_TICKS_PER_MINUTE (60000000UL * LASER_TIMER_TICKS_PER_US)
+
+// Adds the time the laser has been firing since the last call to laser.on_ticks. Called when the laser is
+// extinguished and from the stepper interrupt, which runs at least every 32ms, so the 16 bit timer 5
+// difference can't wrap. Must be called with interrupts off.
+FORCE_INLINE void laser_count_on_time()
+{
+	unsigned int now = TCNT5;
+	if(laser.firing == LASER_ON) { laser.on_ticks += (unsigned int) (now - laser.on_mark); }
+	laser.on_mark = now;
+}
+
+// Fires the laser at a compare value from laser_power_ocr[] or a block's precalculated laser_ocr.
+// Only writes the compare register and the firing pin, so it is cheap enough for every pulse in the stepper interrupt.
+// When a firing duration is set the pulse is ended by timer 5, otherwise the laser stays on.
+FORCE_INLINE void laser_fire_ocr(unsigned int ocr)
+{
+	LASER_INTENSITY_OCR = ocr;
+	WRITE(LASER_FIRING_PIN, LOW);
+	if(laser.firing != LASER_ON) { laser.on_mark = TCNT5; }
+	laser.firing = LASER_ON;
+	if(laser.dur != 0) { laser_pulse_start(); }
+	else { TIMSK5 &= ~(1<<OCIE5B); }
+}
+
+#ifdef LASER_RASTER_BINARY
+	// Binary raster frame: START, flags, sequence, pixel count, pixels..., CRC-16/XMODEM high byte, low byte
+	#define LASER_RASTER_FRAME_START 0xFE
+	#define LASER_RASTER_FRAME_DIRECTION 0x01 // same meaning as the G7 $ value
+	#define LASER_RASTER_FRAME_NEWLINE 0x02 // set when the G7 $ word would be present, increments the Y axis
+	#define LASER_RASTER_FRAME_RLE 0x04 // pixels are run-length encoded (count, power) pairs, see G7 #
+	#define LASER_RASTER_FRAME_PACKED 0x08 // pixels are packed 8 on/off pixels per byte, see G7 !
+	#define LASER_RASTER_FRAME_HEADER 4 // bytes stored in front of the pixels in the command buffer
+#endif // LASER_RASTER_BINARY
+
+// Raster job file header, see M651. Multi-byte fields are little endian.
+typedef struct
+{
+	char magic[4]; // LASER_RASTER_JOB_MAGIC
+	uint8_t flags; // LASER_RASTER_JOB_*
+	uint8_t power; // raster power in percent, as M649 S
+	uint16_t dpi; // pixels per inch along a row, and rows per inch
+	uint16_t feedrate; // engraving feedrate in mm/minute
+	uint16_t row_bytes; // bytes of pixel data per row
+	uint16_t rows; // number of rows
+} laser_raster_job_t;
+
+#define LASER_RASTER_JOB_MAGIC "LRJ1"
+#define LASER_RASTER_JOB_BIDIRECTIONAL 0x01 // every other row is engraved right to left, otherwise all rows are engraved left to right
+#define LASER_RASTER_JOB_PACKED 0x02 // rows are packed 8 on/off pixels per byte, see G7 !
+#define LASER_RASTER_JOB_POWER_MAP 0x04 // a 256 byte pixel value to power map follows the header
+
 #endif // LASER_H
@@ -49,6 +49,12 @@
 #define Z_MIN_PIN          18
 #define Z_MAX_PIN          19
 
+// Pins sharing a port, which the stepper interrupt reads or writes with one port access (see stepper.cpp).
+// Only define a group when all of its pins really are on one port, otherwise the pins are accessed one by one.
+#define XY_STEP_DIR_SAME_PORT // X_STEP_PIN, X_DIR_PIN, Y_STEP_PIN and Y_DIR_PIN are PF0, PF1, PF6 and PF7
+#define X_ENDSTOPS_SAME_PORT // X_MIN_PIN and X_MAX_PIN are PE5 and PE4
+#define Y_ENDSTOPS_SAME_PORT // Y_MIN_PIN and Y_MAX_PIN are PJ1 and PJ0
+
 #define Z2_STEP_PIN        36
 #define Z2_DIR_PIN         34
 #define Z2_ENABLE_PIN      30
@@ -235,6 +241,14 @@
 	#define Z_MIN_PIN          -1
 #endif
 
+// With one endstop of an axis disabled its other endstop is read on its own, as a single pin already is one port access
+#if X_MIN_PIN < 0 || X_MAX_PIN < 0
+	#undef X_ENDSTOPS_SAME_PORT
+#endif
+#if Y_MIN_PIN < 0 || Y_MAX_PIN < 0
+	#undef Y_ENDSTOPS_SAME_PORT
+#endif
+
 #define SENSITIVE_PINS {0, 1, X_STEP_PIN, X_DIR_PIN, X_ENABLE_PIN, X_MIN_PIN, X_MAX_PIN, Y_STEP_PIN, Y_DIR_PIN, Y_ENABLE_PIN, Y_MIN_PIN, Y_MAX_PIN, Z_STEP_PIN, Z_DIR_PIN, Z_ENABLE_PIN, Z_MIN_PIN, Z_MAX_PIN, \
 		HEATER_BED_PIN, FAN_PIN,                  \
 		analogInputToDigitalPin(TEMP_0_PIN), analogInputToDigitalPin(TEMP_1_PIN), analogInputToDigitalPin(TEMP_2_PIN), analogInputToDigitalPin(TEMP_BED_PIN) }
@@ -78,13 +78,27 @@ unsigned long axis_steps_per_sqr_second[NUM_AXIS];
 long position[3];   //rescaled from extern when axis_steps_per_unit are changed by gcode
 static float previous_speed[3]; // Speed of previous path line segment
 static float previous_nominal_speed; // Nominal speed of previous path line segment
+static float previous_unit_vec[3]; // Unit vector of previous path line segment, for junction deviation
 
 //===========================================================================
 //=================semi-private variables, used in inline  functions    =====
 //===========================================================================
 block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion instfructions
+static plan_block_t plan_buffer[BLOCK_BUFFER_SIZE]; // The plan-time data of each block in block_buffer, at the same index
 volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 volatile unsigned char block_buffer_tail;           // Index of the block to process now
+static unsigned char block_buffer_planned;          // Index of the newest block whose entry speed can no longer change
+unsigned char raster_buffer[LASER_RASTER_BUFFER_SIZE];   // A ring buffer for the raster pixels of the planned blocks
+volatile unsigned int raster_buffer_head;               // Index of the next pixel to be pushed
+volatile unsigned int raster_buffer_tail;               // Index of the oldest pixel still in use by a block
+#ifdef PLANNER_BENCHMARK
+unsigned long planner_benchmark_time;                   // Microseconds spent planning blocks, without the waits for buffer space
+unsigned long planner_benchmark_blocks;                 // Number of blocks timed in planner_benchmark_time
+#endif
+
+#if LASER_RASTER_BUFFER_SIZE <= LASER_MAX_RASTER_LINE
+	#error LASER_RASTER_BUFFER_SIZE must be larger than LASER_MAX_RASTER_LINE
+#endif
 
 //===========================================================================
 //=============================private variables ============================
@@ -123,6 +137,16 @@ static int8_t prev_block_index(int8_t block_index)
 	return (block_index);
 }
 
+// Returns the number of pixels that can be pushed to the raster buffer
+static int raster_buffer_free()
+{
+	//Make a local copy of raster_buffer_tail, because the interrupt can alter it
+	CRITICAL_SECTION_START;
+	unsigned int tail = raster_buffer_tail;
+	CRITICAL_SECTION_END;
+	return (LASER_RASTER_BUFFER_SIZE - 1) - ((raster_buffer_head - tail) & (LASER_RASTER_BUFFER_SIZE - 1));
+}
+
 //===========================================================================
 //=============================functions         ============================
 //===========================================================================
@@ -160,12 +184,40 @@ FORCE_INLINE float intersection_distance(float initial_rate, float final_rate, f
 	}
 }
 
-// Calculates trapezoid parameters so that the entry- and exit-speed is compensated by the provided factors.
+#ifdef PLANNER_FIXED_POINT
+// Returns the high 32 bits of a * b. With b = acceleration_st_inverse this is a / (2 * acceleration_st),
+// the number of steps to change the squared step rate by a. Built from 16 x 16 bit products, which the
+// AVR multiplies in hardware, so no 64 bit maths is pulled in. Each partial sum fits in 32 bits.
+FORCE_INLINE unsigned long multiply_high(unsigned long a, unsigned long b)
+{
+	unsigned short a_high = a >> 16, a_low = a, b_high = b >> 16, b_low = b;
+	unsigned long middle = (unsigned long) a_high * b_low + (((unsigned long) a_low * b_low) >> 16);
+	unsigned long middle2 = (unsigned long) a_low * b_high + (middle & 0xffff);
+	return (unsigned long) a_high * b_high + (middle >> 16) + (middle2 >> 16);
+}
+
+// Returns whether a * b > c * d, comparing the 64 bit products by their high and low 32 bits
+FORCE_INLINE bool multiply_greater(unsigned long a, unsigned long b, unsigned long c, unsigned long d)
+{
+	unsigned long high_ab = multiply_high(a, b);
+	unsigned long high_cd = multiply_high(c, d);
+	return high_ab > high_cd || (high_ab == high_cd && a * b > c * d);
+}
+#endif
+
+// Calculates trapezoid parameters so that the block enters at entry_speed and exits at exit_speed (mm/sec).
 
-void calculate_trapezoid_for_block(block_t* block, float entry_factor, float exit_factor)
+void calculate_trapezoid_for_block(block_t* block, plan_block_t* plan, float entry_speed, float exit_speed)
 {
-	unsigned long initial_rate = ceil(block->nominal_rate*entry_factor);    // (step/min)
-	unsigned long final_rate = ceil(block->nominal_rate*exit_factor);    // (step/min)
+#ifdef PLANNER_FIXED_POINT
+	// Step rates are 16 bits, so their squares fit in an unsigned long
+	unsigned long nominal_rate = block->nominal_rate;
+	unsigned long initial_rate = min((unsigned long)(entry_speed*plan->steps_per_mm) + 1, nominal_rate);    // (step/min)
+	unsigned long final_rate = min((unsigned long)(exit_speed*plan->steps_per_mm) + 1, nominal_rate);    // (step/min)
+#else
+	unsigned long initial_rate = ceil(block->nominal_rate*(entry_speed/plan->nominal_speed));    // (step/min)
+	unsigned long final_rate = ceil(block->nominal_rate*(exit_speed/plan->nominal_speed));    // (step/min)
+#endif
 
 	// Limit minimal step rate (Otherwise the timer will overflow.)
 	// STU: TODO: Magic numbers
@@ -178,11 +230,19 @@ void calculate_trapezoid_for_block(block_t* block, float entry_factor, float exi
 		final_rate=120;
 	}
 
-	long acceleration = block->acceleration_st;
+#ifdef PLANNER_FIXED_POINT
+	unsigned long nominal_sq = nominal_rate*nominal_rate;
+	unsigned long initial_sq = initial_rate*initial_rate;
+	unsigned long final_sq = final_rate*final_rate;
+	int32_t accelerate_steps = (nominal_sq > initial_sq) ? multiply_high(nominal_sq-initial_sq, plan->acceleration_st_inverse) + 1 : 0;
+	int32_t decelerate_steps = (nominal_sq > final_sq) ? multiply_high(nominal_sq-final_sq, plan->acceleration_st_inverse) : 0;
+#else
+	long acceleration = plan->acceleration_st;
 	int32_t accelerate_steps =
-	    ceil(estimate_acceleration_distance(block->initial_rate, block->nominal_rate, acceleration));
+	    ceil(estimate_acceleration_distance(initial_rate, block->nominal_rate, acceleration));
 	int32_t decelerate_steps =
-	    floor(estimate_acceleration_distance(block->nominal_rate, block->final_rate, -acceleration));
+	    floor(estimate_acceleration_distance(block->nominal_rate, final_rate, -acceleration));
+#endif
 
 	// Calculate the size of Plateau of Nominal Rate.
 	int32_t plateau_steps = block->step_event_count-accelerate_steps-decelerate_steps;
@@ -192,14 +252,41 @@ void calculate_trapezoid_for_block(block_t* block, float entry_factor, float exi
 	// in order to reach the final_rate exactly at the end of this block.
 	if(plateau_steps < 0)
 	{
-		accelerate_steps = ceil(intersection_distance(block->initial_rate, block->final_rate, acceleration, block->step_event_count));
+#ifdef PLANNER_FIXED_POINT
+		// The intersection is half way along the block, moved by (final_sq - initial_sq) / (4 * acceleration_st)
+		accelerate_steps = (block->step_event_count + 1) >> 1;
+		if(final_sq > initial_sq)
+		{
+			accelerate_steps += multiply_high(final_sq-initial_sq, plan->acceleration_st_inverse) >> 1;
+		}
+		else
+		{
+			accelerate_steps -= multiply_high(initial_sq-final_sq, plan->acceleration_st_inverse) >> 1;
+		}
+#else
+		accelerate_steps = ceil(intersection_distance(initial_rate, final_rate, acceleration, block->step_event_count));
+#endif
 		accelerate_steps = max(accelerate_steps,0);    // Check limits due to numerical round-off
 		accelerate_steps = min((uint32_t) accelerate_steps,block->step_event_count);      //(We can cast here to unsigned, because the above line ensures that we are above zero)
 		plateau_steps = 0;
 	}
 
-	// block->accelerate_until = accelerate_steps;
-	// block->decelerate_after = accelerate_steps+plateau_steps;
+	// Precalc the stepper timer values outside of the critical section
+	unsigned short nominal_timer = calc_timer(block->nominal_rate);
+	unsigned short initial_timer = calc_timer(initial_rate);
+#ifdef S_CURVE_ACCELERATION
+	// The S-curve ramps take as long as the constant acceleration ones, so they cover the same steps
+	unsigned long cruise_rate = block->nominal_rate;
+	if(plateau_steps == 0)
+	{
+		cruise_rate = min((unsigned long) sqrt((float) initial_rate*initial_rate + 2.0*plan->acceleration_st*accelerate_steps), cruise_rate);
+	}
+	unsigned long acceleration_ticks = (cruise_rate > initial_rate) ? (cruise_rate-initial_rate) * (F_CPU / 8.0) / plan->acceleration_st : 0;
+	unsigned long deceleration_ticks = (cruise_rate > final_rate) ? (cruise_rate-final_rate) * (F_CPU / 8.0) / plan->acceleration_st : 0;
+	unsigned long acceleration_inverse = (acceleration_ticks != 0) ? 0xffffffffUL / acceleration_ticks : 0;
+	unsigned long deceleration_inverse = (deceleration_ticks != 0) ? 0xffffffffUL / deceleration_ticks : 0;
+#endif
+
 	CRITICAL_SECTION_START;  // Fill variables used by the stepper in a critical section
 	if(block->busy == false)    // Don't update variables if block is busy.
 	{
@@ -207,6 +294,15 @@ void calculate_trapezoid_for_block(block_t* block, float entry_factor, float exi
 		block->decelerate_after = accelerate_steps+plateau_steps;
 		block->initial_rate = initial_rate;
 		block->final_rate = final_rate;
+		block->OCR1A_nominal = nominal_timer;
+		block->acceleration_time = initial_timer;
+#ifdef S_CURVE_ACCELERATION
+		block->cruise_rate = cruise_rate;
+		block->acceleration_ticks = acceleration_ticks;
+		block->acceleration_inverse = acceleration_inverse;
+		block->deceleration_ticks = deceleration_ticks;
+		block->deceleration_inverse = deceleration_inverse;
+#endif
 	}
 	CRITICAL_SECTION_END;
 }
@@ -228,7 +324,7 @@ FORCE_INLINE float max_allowable_speed(float acceleration, float target_velocity
 
 
 // The kernel called by planner_recalculate() when scanning the plan from last to first entry.
-void planner_reverse_pass_kernel(block_t* previous, block_t* current, block_t* next)
+void planner_reverse_pass_kernel(plan_block_t* previous, plan_block_t* current, plan_block_t* next)
 {
 	if(!current)
 	{
@@ -261,40 +357,33 @@ void planner_reverse_pass_kernel(block_t* previous, block_t* current, block_t* n
 }
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This
-// implements the reverse pass.
+// implements the reverse pass, from the newest block back to block_buffer_planned. The newest block
+// already has its entry speed set by plan_buffer_line().
 void planner_reverse_pass()
 {
-	uint8_t block_index = block_buffer_head;
+	uint8_t block_index = prev_block_index(block_buffer_head);
+	plan_block_t* next = NULL;
+	plan_block_t* current = &plan_buffer[block_index];
 
-	//Make a local copy of block_buffer_tail, because the interrupt can alter it
-	CRITICAL_SECTION_START;
-	unsigned char tail = block_buffer_tail;
-	CRITICAL_SECTION_END
-
-	if(((block_buffer_head-tail + BLOCK_BUFFER_SIZE) & (BLOCK_BUFFER_SIZE - 1)) > 3)
+	while(block_index != block_buffer_planned)
 	{
-		block_index = (block_buffer_head - 3) & (BLOCK_BUFFER_SIZE - 1);
-		block_t* block[3] =
-		{
-			NULL, NULL, NULL
-		};
-		while(block_index != tail)
+		block_index = prev_block_index(block_index);
+		next = current;
+		current = &plan_buffer[block_index];
+		if(block_index != block_buffer_planned)
 		{
-			block_index = prev_block_index(block_index);
-			block[2]= block[1];
-			block[1]= block[0];
-			block[0] = &block_buffer[block_index];
-			planner_reverse_pass_kernel(block[0], block[1], block[2]);
+			planner_reverse_pass_kernel(NULL, current, next);
 		}
 	}
 }
 
 // The kernel called by planner_recalculate() when scanning the plan from first to last entry.
-void planner_forward_pass_kernel(block_t* previous, block_t* current, block_t* next)
+// Returns true when the entry speed of current can no longer change as more blocks are planned.
+bool planner_forward_pass_kernel(plan_block_t* previous, plan_block_t* current, plan_block_t* next)
 {
 	if(!previous)
 	{
-		return;
+		return false;
 	}
 
 	// If the previous block is an acceleration block, but it is not long enough to complete the
@@ -313,53 +402,55 @@ void planner_forward_pass_kernel(block_t* previous, block_t* current, block_t* n
 			{
 				current->entry_speed = entry_speed;
 				current->recalculate_flag = true;
+				return true; // Limited by full acceleration from the previous block
 			}
 		}
 	}
+	return current->entry_speed == current->max_entry_speed;
 }
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This
-// implements the forward pass.
+// implements the forward pass, from block_buffer_planned to the newest block, and moves
+// block_buffer_planned up to the newest block that is now optimally planned.
 void planner_forward_pass()
 {
-	uint8_t block_index = block_buffer_tail;
-	block_t* block[3] =
-	{
-		NULL, NULL, NULL
-	};
+	uint8_t block_index = block_buffer_planned;
+	plan_block_t* previous = &plan_buffer[block_index];
+	plan_block_t* current;
 
+	block_index = next_block_index(block_index);
 	while(block_index != block_buffer_head)
 	{
-		block[0] = block[1];
-		block[1] = block[2];
-		block[2] = &block_buffer[block_index];
-		planner_forward_pass_kernel(block[0],block[1],block[2]);
+		current = &plan_buffer[block_index];
+		if(planner_forward_pass_kernel(previous, current, NULL))
+		{
+			block_buffer_planned = block_index;
+		}
+		previous = current;
 		block_index = next_block_index(block_index);
 	}
-	planner_forward_pass_kernel(block[1], block[2], NULL);
 }
 
 // Recalculates the trapezoid speed profiles for all blocks in the plan according to the
-// entry_factor for each junction. Must be called by planner_recalculate() after
-// updating the blocks.
-void planner_recalculate_trapezoids()
+// entry_factor for each junction, starting at block_index. Must be called by planner_recalculate()
+// after updating the blocks.
+void planner_recalculate_trapezoids(int8_t block_index)
 {
-	int8_t block_index = block_buffer_tail;
-	block_t* current;
-	block_t* next = NULL;
+	plan_block_t* current;
+	plan_block_t* next = NULL;
 
 	while(block_index != block_buffer_head)
 	{
 		current = next;
-		next = &block_buffer[block_index];
+		next = &plan_buffer[block_index];
 		if(current)
 		{
 			// Recalculate if current block entry or exit junction speed has changed.
 			if(current->recalculate_flag || next->recalculate_flag)
 			{
 				// NOTE: Entry and exit factors always > 0 by all previous logic operations.
-				calculate_trapezoid_for_block(current, current->entry_speed/current->nominal_speed,
-				                              next->entry_speed/current->nominal_speed);
+				calculate_trapezoid_for_block(&block_buffer[prev_block_index(block_index)], current,
+				                              current->entry_speed, next->entry_speed);
 				current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
 			}
 		}
@@ -368,8 +459,8 @@ void planner_recalculate_trapezoids()
 	// Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
 	if(next != NULL)
 	{
-		calculate_trapezoid_for_block(next, next->entry_speed/next->nominal_speed,
-		                              MINIMUM_PLANNER_SPEED/next->nominal_speed);
+		calculate_trapezoid_for_block(&block_buffer[prev_block_index(block_index)], next,
+		                              next->entry_speed, MINIMUM_PLANNER_SPEED);
 		next->recalculate_flag = false;
 	}
 }
@@ -390,18 +481,38 @@ void planner_recalculate_trapezoids()
 // the set limit. Finally it will:
 //
 //   3. Recalculate trapezoids for all blocks.
+//
+// Blocks up to block_buffer_planned already have their optimal entry speed, as it is either their
+// max_entry_speed or limited by full acceleration from the block before, so all three steps only
+// go over the blocks after it. With a full buffer of short segments this keeps the cost of
+// planning a block close to constant.
 
 void planner_recalculate()
 {
+	//Make a local copy of block_buffer_tail, because the interrupt can alter it
+	CRITICAL_SECTION_START;
+	unsigned char tail = block_buffer_tail;
+	CRITICAL_SECTION_END
+
+	// The block being executed can't change either, so start there once it has passed block_buffer_planned
+	if(((block_buffer_planned - tail) & (BLOCK_BUFFER_SIZE - 1)) >= ((block_buffer_head - tail) & (BLOCK_BUFFER_SIZE - 1)))
+	{
+		block_buffer_planned = tail;
+	}
+	uint8_t planned = block_buffer_planned;
+
 	planner_reverse_pass();
 	planner_forward_pass();
-	planner_recalculate_trapezoids();
+	planner_recalculate_trapezoids(planned);
 }
 
 void plan_init()
 {
 	block_buffer_head = 0;
 	block_buffer_tail = 0;
+	block_buffer_planned = 0;
+	raster_buffer_head = 0;
+	raster_buffer_tail = 0;
 	memset(position, 0, sizeof(position));       // clear position
 	previous_speed[0] = 0.0;
 	previous_speed[1] = 0.0;
@@ -418,17 +529,19 @@ void check_axes_activity()
 	unsigned char z_active = 0;
 	unsigned char tail_fan_speed = fanSpeed;
 	block_t* block;
+	plan_block_t* plan;
 
 	if(block_buffer_tail != block_buffer_head)
 	{
 		uint8_t block_index = block_buffer_tail;
-		tail_fan_speed = block_buffer[block_index].fan_speed;
+		tail_fan_speed = plan_buffer[block_index].fan_speed;
 		while(block_index != block_buffer_head)
 		{
 			block = &block_buffer[block_index];
+			plan = &plan_buffer[block_index];
 			if(block->steps_x != 0) { x_active++; }
 			if(block->steps_y != 0) { y_active++; }
-			if(block->steps_z != 0) { z_active++; }
+			if(plan->steps_z != 0) { z_active++; }
 			block_index = (block_index+1) & (BLOCK_BUFFER_SIZE - 1);
 		}
 	}
@@ -446,7 +559,7 @@ void check_axes_activity()
 }
 
 
-float junction_deviation = 0.1;
+float junction_deviation;
 // Add a new linear movement to the buffer. steps_x, _y and _z is the absolute position in
 // mm. Microseconds specify how many microseconds the move should take to perform. To aid acceleration
 // calculation the caller must also provide the physical length of the line in millimeters.
@@ -464,6 +577,9 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 		manage_inactivity();
 		lcd_update();
 	}
+#ifdef PLANNER_BENCHMARK
+	unsigned long benchmark_start = micros();
+#endif
 
 	// The target position of the tool in absolute steps
 	// Calculate target position in absolute steps
@@ -475,6 +591,7 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 
 	// Prepare to set up new block
 	block_t* block = &block_buffer[block_buffer_head];
+	plan_block_t* plan = &plan_buffer[block_buffer_head];
 
 	// Mark block as not busy (Not executed by the stepper interrupt)
 	block->busy = false;
@@ -482,11 +599,18 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 	// Number of steps for each axis
 	block->steps_x = labs(target[X_AXIS]-position[X_AXIS]);
 	block->steps_y = labs(target[Y_AXIS]-position[Y_AXIS]);
-	block->steps_z = labs(target[Z_AXIS]-position[Z_AXIS]);
+	plan->steps_z = labs(target[Z_AXIS]-position[Z_AXIS]);
+
+	block->step_event_count = max(block->steps_x, max(block->steps_y, plan->steps_z));
 
-	block->step_event_count = max(block->steps_x, max(block->steps_y, block->steps_z));
+	// Every block carries the whole laser state, so a move without steps has nothing to do. Queueing it
+	// would only make the planner stop at the junction, so power and M3/M5 changes ride the next move.
+	if(block->step_event_count == 0)
+	{
+		return;
+	}
 
-	block->fan_speed = fanSpeed;
+	plan->fan_speed = fanSpeed;
 	// Compute direction bits for this block
 	block->direction_bits = 0;
 	if(target[X_AXIS] < position[X_AXIS])
@@ -505,58 +629,89 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 	//enable active axes
 	if(block->steps_x != 0) { enable_x(); }
 	if(block->steps_y != 0) { enable_y(); }
-	if(block->steps_z != 0) { enable_z(); }
+	if(plan->steps_z != 0) { enable_z(); }
 
 	float delta_mm[3];
 	delta_mm[X_AXIS] = (target[X_AXIS]-position[X_AXIS]) /axis_steps_per_unit[X_AXIS];
 	delta_mm[Y_AXIS] = (target[Y_AXIS]-position[Y_AXIS]) /axis_steps_per_unit[Y_AXIS];
 	delta_mm[Z_AXIS] = (target[Z_AXIS]-position[Z_AXIS]) /axis_steps_per_unit[Z_AXIS];
-	if(block->steps_x <=dropsegments && block->steps_y <=dropsegments && block->steps_z <=dropsegments)
+	if(block->steps_x <=dropsegments && block->steps_y <=dropsegments && plan->steps_z <=dropsegments)
 	{
-		block->millimeters = 0.0;	// fabs(delta_mm[E_AXIS]);
+		plan->millimeters = 0.0;	// fabs(delta_mm[E_AXIS]);
 	}
 	else
 	{
-		block->millimeters = sqrt(square(delta_mm[X_AXIS]) + square(delta_mm[Y_AXIS]) + square(delta_mm[Z_AXIS]));
+		plan->millimeters = sqrt(square(delta_mm[X_AXIS]) + square(delta_mm[Y_AXIS]) + square(delta_mm[Z_AXIS]));
 	}
 
-	block->laser_intensity = laser.intensity;
+	block->laser_intensity = constrain(laser.intensity, 0, 100);
+	block->laser_ocr = laser_power_ocr[block->laser_intensity];
+#ifdef LASER_VELOCITY_POWER
+	block->laser_velocity_power = laser.velocity_power && laser.mode == CONTINUOUS && laser.status == LASER_ON;
+	block->laser_ocr_min = min(laser_power_ocr[constrain(laser.velocity_min_power, 0, 100)], block->laser_ocr);
+#endif
 	block->laser_duration = laser.duration;
 	block->laser_status = laser.status;
+#ifdef LASER_PERIPHERALS
+	// Start the peripherals while the planner is still filling, so they are usually ready by the time this block runs
+	if(block->laser_status == LASER_ON) { laser_peripherals_on(); }
+#endif
 	block->laser_mode = laser.mode;
 
 	// When operating in PULSED or RASTER modes, laser pulsing must operate in sync with movement.
 	// Calculate steps between laser firings (steps_l) and consider that when determining largest
 	// interval between steps for X, Y, Z, L to feed to the motion control code.
+	block->laser_raster_length = 0;
+	block->laser_raster_packed = false;
 	if(laser.mode == RASTER || laser.mode == PULSED)
 	{
-		block->steps_l = labs(block->millimeters*laser.ppm);
-		for(int i = 0; i < LASER_MAX_RASTER_LINE; i++)
-		{
-
-			//Scale the image intensity based on the raster power.
-			//100% power on a pixel basis is 255, convert back to 255 = 100.
-
-			// STU: I SEE A MAGIC NUMBER BODGE HERE: FIXME:
-			//http://stackoverflow.com/questions/929103/convert-a-number-range-to-another-range-maintaining-ratio
-			int OldRange, NewRange;
-			float NewValue;
-			OldRange = (255 - 0);
-			NewRange = (laser.rasterlaserpower - 7);   //7% power on my unit outputs hardly any noticable burn at F3000 on paper, so adjust the raster contrast based off 7 being the lower. 7 still produces burns at slower feed rates, but getting less power than this isn't typically needed at slow feed rates.
-			NewValue = (float)(((((float) laser.raster_data[i] - 0) * NewRange) / OldRange) + 7);
+		block->steps_l = labs(plan->millimeters*laser.ppm);
+	}
+	else
+	{
+		block->steps_l = 0;
+	}
+	if(laser.mode == RASTER)
+	{
+		block->laser_raster_packed = laser.raster_packed;
+		block->laser_raster_length = min(laser.raster_num_pixels, laser.raster_packed ? LASER_MAX_RASTER_LINE * 8 : LASER_MAX_RASTER_LINE);
+		int num_bytes = plan_raster_bytes(block);
 
-			//If less than 7%, turn off the laser tube.
-			if(NewValue == 7)
-			{ NewValue = 0; }
+		// Rest here until the stepper has drained enough pixels from the raster buffer.
+#ifdef PLANNER_BENCHMARK
+		unsigned long wait_start = micros();
+#endif
+		while(raster_buffer_free() < num_bytes)
+		{
+			manage_inactivity();
+			lcd_update();
+		}
+#ifdef PLANNER_BENCHMARK
+		benchmark_start += micros() - wait_start;
+#endif
 
-			block->laser_raster_data[i] = NewValue;
+		unsigned int raster_index = raster_buffer_head;
+		block->laser_raster_start = raster_index;
+		for(int i = 0; i < num_bytes; i++)
+		{
+			//Scale the image intensity based on the raster power, see laser_update_raster_power_map()
+			//Packed pixels are only on or off and are fired at laser_intensity by the stepper.
+			raster_buffer[raster_index] = laser.raster_packed ? laser.raster_data[i] : laser.raster_power_map[laser.raster_data[i]];
+			raster_index = (raster_index + 1) & (LASER_RASTER_BUFFER_SIZE - 1);
 		}
 	}
-	else
+#ifdef LASER_PULSE_CLOCK
+	// Raster pixels and pulses are fired by their own clock in the stepper, so they don't add step events
+	block->laser_pulses = (laser.mode == RASTER) ? block->laser_raster_length : min(block->steps_l, 0xffffL);
+	block->steps_l = 0;
+#endif
+	block->step_event_count = max(block->steps_x, max(block->steps_y, max(plan->steps_z, block->steps_l)));
+#ifdef LASER_PULSE_CLOCK
+	if(block->laser_pulses != 0)
 	{
-		block->steps_l = 0;
+		block->laser_steps_per_pulse = (block->step_event_count << 8) / block->laser_pulses;
 	}
-	block->step_event_count = max(block->steps_x, max(block->steps_y, max(block->steps_z, block->steps_l)));
+#endif
 
 #if defined( LASER_DIAGNOSTICS )
 	if(block->laser_status == LASER_ON)
@@ -566,7 +721,7 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 	}
 #endif
 
-	float inverse_millimeters = 1.0/block->millimeters;  // Inverse millimeters to remove multiple divides
+	float inverse_millimeters = 1.0/plan->millimeters;  // Inverse millimeters to remove multiple divides
 
 	// Calculate speed in mm/second for each axis. No divide by zero due to previous checks.
 	float inverse_second = feed_rate * inverse_millimeters;
@@ -592,8 +747,8 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 	//  END OF SLOW DOWN SECTION
 
 
-	block->nominal_speed = block->millimeters * inverse_second; // (mm/sec) Always > 0
-	block->nominal_rate = ceil(block->step_event_count * inverse_second);    // (step/sec) Always > 0
+	plan->nominal_speed = plan->millimeters * inverse_second; // (mm/sec) Always > 0
+	unsigned long nominal_rate = ceil(block->step_event_count * inverse_second);    // (step/sec) Always > 0
 
 	// Calculate and limit speed in mm/sec for each axis
 	float current_speed[3];
@@ -647,86 +802,103 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 		{
 			current_speed[i] *= speed_factor;
 		}
-		block->nominal_speed *= speed_factor;
-		block->nominal_rate *= speed_factor;
+		plan->nominal_speed *= speed_factor;
+		nominal_rate *= speed_factor;
 	}
+	// The stepper works with 16 bit step rates, far above MAX_STEP_FREQUENCY
+	block->nominal_rate = min(nominal_rate, 0xffffUL);
+
+#ifdef LASER_VELOCITY_POWER
+	if(block->laser_velocity_power)
+	{ block->laser_rate_inverse = 0x1000000UL / block->nominal_rate; }
+#endif
 
 	// Compute and limit the acceleration rate for the trapezoid generator.
-	float steps_per_mm = block->step_event_count/block->millimeters;
-	if(block->steps_x == 0 && block->steps_y == 0 && block->steps_z == 0)
+	float steps_per_mm = block->step_event_count/plan->millimeters;
+	if(block->steps_x == 0 && block->steps_y == 0 && plan->steps_z == 0)
 	{
-		block->acceleration_st = ceil(retract_acceleration * steps_per_mm);    // convert to: acceleration steps/sec^2
+		plan->acceleration_st = ceil(retract_acceleration * steps_per_mm);    // convert to: acceleration steps/sec^2
 	}
 	else
 	{
-		block->acceleration_st = ceil(acceleration * steps_per_mm);    // convert to: acceleration steps/sec^2
+		plan->acceleration_st = ceil(acceleration * steps_per_mm);    // convert to: acceleration steps/sec^2
 		// Limit acceleration per axis
-		if(((float) block->acceleration_st * (float) block->steps_x / (float) block->step_event_count) > axis_steps_per_sqr_second[X_AXIS])
-		{ block->acceleration_st = axis_steps_per_sqr_second[X_AXIS]; }
-		if(((float) block->acceleration_st * (float) block->steps_y / (float) block->step_event_count) > axis_steps_per_sqr_second[Y_AXIS])
-		{ block->acceleration_st = axis_steps_per_sqr_second[Y_AXIS]; }
-		if(((float) block->acceleration_st * (float) block->steps_z / (float) block->step_event_count) > axis_steps_per_sqr_second[Z_AXIS])
-		{ block->acceleration_st = axis_steps_per_sqr_second[Z_AXIS]; }
+#ifdef PLANNER_FIXED_POINT
+		if(multiply_greater(plan->acceleration_st, block->steps_x, axis_steps_per_sqr_second[X_AXIS], block->step_event_count))
+		{ plan->acceleration_st = axis_steps_per_sqr_second[X_AXIS]; }
+		if(multiply_greater(plan->acceleration_st, block->steps_y, axis_steps_per_sqr_second[Y_AXIS], block->step_event_count))
+		{ plan->acceleration_st = axis_steps_per_sqr_second[Y_AXIS]; }
+		if(multiply_greater(plan->acceleration_st, plan->steps_z, axis_steps_per_sqr_second[Z_AXIS], block->step_event_count))
+		{ plan->acceleration_st = axis_steps_per_sqr_second[Z_AXIS]; }
+#else
+		if(((float) plan->acceleration_st * (float) block->steps_x / (float) block->step_event_count) > axis_steps_per_sqr_second[X_AXIS])
+		{ plan->acceleration_st = axis_steps_per_sqr_second[X_AXIS]; }
+		if(((float) plan->acceleration_st * (float) block->steps_y / (float) block->step_event_count) > axis_steps_per_sqr_second[Y_AXIS])
+		{ plan->acceleration_st = axis_steps_per_sqr_second[Y_AXIS]; }
+		if(((float) plan->acceleration_st * (float) plan->steps_z / (float) block->step_event_count) > axis_steps_per_sqr_second[Z_AXIS])
+		{ plan->acceleration_st = axis_steps_per_sqr_second[Z_AXIS]; }
+#endif
 	}
-	block->acceleration = block->acceleration_st / steps_per_mm;
-	block->acceleration_rate = (long)((float) block->acceleration_st * (16777216.0 / (F_CPU / 8.0)));
+	plan->acceleration = plan->acceleration_st / steps_per_mm;
+#ifdef PLANNER_FIXED_POINT
+	// Step rates follow the 16 bit cap of nominal_rate, as the float version scales them by nominal_rate
+	plan->steps_per_mm = (nominal_rate > block->nominal_rate) ? steps_per_mm * block->nominal_rate / nominal_rate : steps_per_mm;
+	plan->acceleration_st_inverse = 0x80000000UL / plan->acceleration_st;
+	// 2^24 / (F_CPU / 8) as a whole part and a 0.32 fixed point fraction, both folded by the compiler
+	block->acceleration_rate = plan->acceleration_st * (unsigned long)(16777216.0 / (F_CPU / 8.0)) +
+	                           multiply_high(plan->acceleration_st, (16777216.0 / (F_CPU / 8.0) - (unsigned long)(16777216.0 / (F_CPU / 8.0))) * 4294967296.0);
+#else
+	block->acceleration_rate = (long)((float) plan->acceleration_st * (16777216.0 / (F_CPU / 8.0)));
+#endif
 
-#if 0  // Use old jerk for now
-	// Compute path unit vector
-	double unit_vec[3];
+	// Start with a safe speed
+	float vmax_junction = max_xy_jerk/2;
+	float vmax_junction_factor = 1.0;
+	if(fabs(current_speed[Z_AXIS]) > max_z_jerk/2)
+	{ vmax_junction = min(vmax_junction, max_z_jerk/2); }
+	vmax_junction = min(vmax_junction, plan->nominal_speed);
+	float safe_speed = vmax_junction;
 
+	float unit_vec[3];
 	unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_millimeters;
 	unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_millimeters;
 	unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_millimeters;
 
-	// Compute maximum allowable entry speed at junction by centripetal acceleration approximation.
-	// Let a circle be tangent to both previous and current path line segments, where the junction
-	// deviation is defined as the distance from the junction to the closest edge of the circle,
-	// colinear with the circle center. The circular segment joining the two paths represents the
-	// path of centripetal acceleration. Solve for max velocity based on max acceleration about the
-	// radius of the circle, defined indirectly by junction deviation. This may be also viewed as
-	// path width or max_jerk in the previous grbl version. This approach does not actually deviate
-	// from path, but used as a robust way to compute cornering speeds, as it takes into account the
-	// nonlinearities of both the junction angle and junction velocity.
-	double vmax_junction = MINIMUM_PLANNER_SPEED; // Set default max junction speed
-
-	// Skip first block or when previous_nominal_speed is used as a flag for homing and offset cycles.
-	if((block_buffer_head != block_buffer_tail) && (previous_nominal_speed > 0.0))
+	if((moves_queued > 1) && (previous_nominal_speed > 0.0001) && (junction_deviation > 0.0))
 	{
+		// Compute maximum allowable entry speed at junction by centripetal acceleration approximation.
+		// Let a circle be tangent to both previous and current path line segments, where the junction
+		// deviation is defined as the distance from the junction to the closest edge of the circle,
+		// colinear with the circle center. The circular segment joining the two paths represents the
+		// path of centripetal acceleration. Solve for max velocity based on max acceleration about the
+		// radius of the circle, defined indirectly by junction deviation. This approach does not actually
+		// deviate from path, but used as a robust way to compute cornering speeds, as it takes into account
+		// the nonlinearities of both the junction angle and junction velocity.
 		// Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
 		// NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
-		double cos_theta = - previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
-		                   - previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
-		                   - previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS] ;
+		float cos_theta = - previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
+		                  - previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
+		                  - previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS] ;
 
-		// Skip and use default max junction speed for 0 degree acute junction.
+		// Skip and use the safe speed for 0 degree acute junctions.
 		if(cos_theta < 0.95)
 		{
-			vmax_junction = min(previous_nominal_speed,block->nominal_speed);
+			vmax_junction = min(previous_nominal_speed, plan->nominal_speed);
 			// Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
 			if(cos_theta > -0.95)
 			{
 				// Compute maximum junction velocity based on maximum acceleration and junction deviation
-				double sin_theta_d2 = sqrt(0.5* (1.0-cos_theta));      // Trig half angle identity. Always positive.
+				float sin_theta_d2 = sqrt(0.5*(1.0-cos_theta));      // Trig half angle identity. Always positive.
 				vmax_junction = min(vmax_junction,
-				                    sqrt(block->acceleration * junction_deviation * sin_theta_d2/ (1.0-sin_theta_d2)));
+				                    sqrt(plan->acceleration * junction_deviation * sin_theta_d2/(1.0-sin_theta_d2)));
 			}
 		}
 	}
-#endif
-	// Start with a safe speed
-	float vmax_junction = max_xy_jerk/2;
-	float vmax_junction_factor = 1.0;
-	if(fabs(current_speed[Z_AXIS]) > max_z_jerk/2)
-	{ vmax_junction = min(vmax_junction, max_z_jerk/2); }
-	vmax_junction = min(vmax_junction, block->nominal_speed);
-	float safe_speed = vmax_junction;
-
-	if((moves_queued > 1) && (previous_nominal_speed > 0.0001))
+	else if((moves_queued > 1) && (previous_nominal_speed > 0.0001))
 	{
-		float jerk = sqrt(pow((current_speed[X_AXIS]-previous_speed[X_AXIS]), 2)+pow((current_speed[Y_AXIS]-previous_speed[Y_AXIS]), 2));
+		float jerk = sqrt(square(current_speed[X_AXIS]-previous_speed[X_AXIS])+square(current_speed[Y_AXIS]-previous_speed[Y_AXIS]));
 		//    if((fabs(previous_speed[X_AXIS]) > 0.0001) || (fabs(previous_speed[Y_AXIS]) > 0.0001)) {
-		vmax_junction = block->nominal_speed;
+		vmax_junction = plan->nominal_speed;
 		//    }
 		if(jerk > max_xy_jerk)
 		{
@@ -738,11 +910,11 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 		}
 		vmax_junction = min(previous_nominal_speed, vmax_junction * vmax_junction_factor);    // Limit speed to max previous speed
 	}
-	block->max_entry_speed = vmax_junction;
+	plan->max_entry_speed = vmax_junction;
 
 	// Initialize block entry speed. Compute based on deceleration to user-defined MINIMUM_PLANNER_SPEED.
-	double v_allowable = max_allowable_speed(-block->acceleration,MINIMUM_PLANNER_SPEED,block->millimeters);
-	block->entry_speed = min(vmax_junction, v_allowable);
+	double v_allowable = max_allowable_speed(-plan->acceleration,MINIMUM_PLANNER_SPEED,plan->millimeters);
+	plan->entry_speed = min(vmax_junction, v_allowable);
 
 	// Initialize planner efficiency flags
 	// Set flag if block will always reach maximum junction speed regardless of entry/exit speeds.
@@ -752,34 +924,37 @@ void plan_buffer_line(const float& x, const float& y, const float& z, float feed
 	// block nominal speed limits both the current and next maximum junction speeds. Hence, in both
 	// the reverse and forward planners, the corresponding block junction speed will always be at the
 	// the maximum junction speed and may always be ignored for any speed reduction checks.
-	if(block->nominal_speed <= v_allowable)
+	if(plan->nominal_speed <= v_allowable)
 	{
-		block->nominal_length_flag = true;
+		plan->nominal_length_flag = true;
 	}
 	else
 	{
-		block->nominal_length_flag = false;
+		plan->nominal_length_flag = false;
 	}
-	block->recalculate_flag = true; // Always calculate trapezoid for new block
+	plan->recalculate_flag = true; // Always calculate trapezoid for new block
 
 	// Update previous path unit_vector and nominal speed
 	memcpy(previous_speed, current_speed, sizeof(previous_speed));       // previous_speed[] = current_speed[]
-	previous_nominal_speed = block->nominal_speed;
+	memcpy(previous_unit_vec, unit_vec, sizeof(previous_unit_vec));       // previous_unit_vec[] = unit_vec[]
+	previous_nominal_speed = plan->nominal_speed;
 
 
-	calculate_trapezoid_for_block(block, block->entry_speed/block->nominal_speed,
-	                              safe_speed/block->nominal_speed);
+	calculate_trapezoid_for_block(block, plan, plan->entry_speed, safe_speed);
 
 	// Move buffer head
 	block_buffer_head = next_buffer_head;
+	raster_buffer_head = (raster_buffer_head + plan_raster_bytes(block)) & (LASER_RASTER_BUFFER_SIZE - 1);
 
 	// Update position
 	memcpy(position, target, sizeof(target));       // position[] = target[]
 
 	planner_recalculate();
 
-	current_block->OCR1A_nominal = calc_timer(current_block->nominal_rate);
-	current_block->acceleration_time = calc_timer(current_block->initial_rate);
+#ifdef PLANNER_BENCHMARK
+	planner_benchmark_time += micros() - benchmark_start;
+	planner_benchmark_blocks++;
+#endif
 
 	st_wake_up();
 }
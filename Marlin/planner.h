@@ -27,45 +27,72 @@
 #include "Marlin.h"
 #include "laser.h"
 
-// This struct is used when buffering the setup for each linear movement "nominal" values are as specified in
-// the source g-code and may never actually be reached if acceleration management is active.
+// This struct is used when buffering the setup for each linear movement. It only holds what the stepper
+// interrupt needs, the planner keeps the rest in plan_block_t so more blocks fit in the lookahead.
 typedef struct
 {
 	// Fields used by the bresenham algorithm for tracing the line
-	long steps_x, steps_y, steps_z;			  // Step count along each axis
+	long steps_x, steps_y;					  // Step count along each axis
 	unsigned long step_event_count;           // The number of step events required to complete this block
 	long accelerate_until;                    // The index of the step event on which to stop acceleration
 	long decelerate_after;                    // The index of the step event on which to start decelerating
 	long acceleration_rate;                   // The acceleration rate used for acceleration calculation
 	unsigned char direction_bits;             // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
 
-	// Fields used by the motion planner to manage acceleration
-//  float speed_x, speed_y, speed_z, speed_e;		   // Nominal mm/sec for each axis
+	// Settings for the trapezoid generator, in the 16 bit step rates the stepper works with
+	unsigned int nominal_rate;                         // The nominal step rate for this block in step_events/sec
+	unsigned int initial_rate;                         // The jerk-adjusted step rate at start of block
+	unsigned int final_rate;                           // The minimal rate at exit
+	unsigned short acceleration_time;					// Precalc of calc_timer(initial_rate);
+	unsigned short OCR1A_nominal;						// Precalc of calc_timer(nominal_rate);
+	uint8_t laser_mode; // CONTINUOUS, PULSED, RASTER
+	bool laser_status; // LASER_OFF, LASER_ON
+	unsigned long laser_duration; // laser firing duration in microseconds, for pulsed and raster firing modes
+	long steps_l; // step count between firings of the laser, for pulsed firing mode
+	unsigned char laser_intensity; // Laser firing instensity in percent
+	unsigned int laser_ocr; // Precalc of the PWM compare value for laser_intensity
+	unsigned int laser_raster_start; // Index of the first pixel of this block in raster_buffer
+	unsigned int laser_raster_length; // Number of pixels of this block in raster_buffer
+	bool laser_raster_packed; // The pixels are packed 8 on/off pixels per byte in raster_buffer
+#ifdef LASER_VELOCITY_POWER
+	unsigned long laser_rate_inverse; // 2^24 / nominal_rate, to scale laser power by the step rate without dividing
+	bool laser_velocity_power; // CONTINUOUS mode power follows the step rate
+	unsigned int laser_ocr_min; // PWM compare value of the lowest power while slowed down, never above laser_ocr
+#endif
+#ifdef S_CURVE_ACCELERATION
+	unsigned int cruise_rate; // Step rate at the end of the acceleration, below nominal_rate when there is no plateau
+	unsigned long acceleration_ticks; // Duration of the acceleration in timer ticks
+	unsigned long acceleration_inverse; // (2^32 - 1) / acceleration_ticks
+	unsigned long deceleration_ticks; // Duration of the deceleration in timer ticks
+	unsigned long deceleration_inverse; // (2^32 - 1) / deceleration_ticks
+#endif
+#ifdef LASER_PULSE_CLOCK
+	unsigned int laser_pulses; // Number of raster pixels or PULSED mode pulses fired by the pulse clock
+	unsigned long laser_steps_per_pulse; // Step events between pulses, 24.8 fixed point, for the pulse clock
+#endif
+	volatile char busy;
+} block_t;
+
+// The fields of a block only used by the planner to manage acceleration, kept at the same index as
+// the block_t in block_buffer. "nominal" values are as specified in the source g-code and may never
+// actually be reached if acceleration management is active.
+typedef struct
+{
+	long steps_z;                                      // Z steps, the stepper doesn't move Z
 	float nominal_speed;                               // The nominal speed for this block in mm/sec
 	float entry_speed;                                 // Entry speed at previous-current junction in mm/sec
 	float max_entry_speed;                             // Maximum allowable junction entry speed in mm/sec
 	float millimeters;                                 // The total travel of this block in mm
 	float acceleration;                                // acceleration mm/sec^2
+	unsigned long acceleration_st;                     // acceleration steps/sec^2
+#ifdef PLANNER_FIXED_POINT
+	float steps_per_mm; // Step events per mm, to turn junction speeds into step rates with one multiply
+	unsigned long acceleration_st_inverse; // 2^31 / acceleration_st, to get acceleration distances without dividing
+#endif
 	unsigned char recalculate_flag;                    // Planner flag to recalculate trapezoids on entry junction
 	unsigned char nominal_length_flag;                 // Planner flag for nominal speed always reached
-
-	// Settings for the trapezoid generator
-	unsigned long nominal_rate;                        // The nominal step rate for this block in step_events/sec
-	unsigned long initial_rate;                        // The jerk-adjusted step rate at start of block
-	unsigned long final_rate;                          // The minimal rate at exit
-	unsigned long acceleration_st;                     // acceleration steps/sec^2
-	unsigned long fan_speed;
-	uint8_t laser_mode; // CONTINUOUS, PULSED, RASTER
-	bool laser_status; // LASER_OFF, LASER_ON
-	float laser_ppm; // pulses per millimeter, for pulsed and raster firing modes
-	unsigned long laser_duration; // laser firing duration in microseconds, for pulsed and raster firing modes
-	long steps_l; // step count between firings of the laser, for pulsed firing mode
-	int laser_intensity; // Laser firing instensity in clock cycles for the PWM timer
-	long acceleration_time;								// Precalc of calc_timer(acc_step_rate);
-	unsigned short OCR1A_nominal;						// Precalc of calc_timer(current_block->nominal_rate);
-	unsigned char laser_raster_data[LASER_MAX_RASTER_LINE];
-	volatile char busy;
-} block_t;
+	unsigned char fan_speed;
+} plan_block_t;
 
 // Initialize the motion plan subsystem
 void plan_init();
@@ -92,18 +119,37 @@ extern float retract_acceleration; //  mm/s^2   filament pull-pack and push-forw
 extern float max_xy_jerk; //speed than can be stopped at once, if i understand correctly.
 extern float max_z_jerk;
 extern float max_e_jerk;
+extern float junction_deviation; // mm, 0.0 to corner by the jerk limits instead
 extern float mintravelfeedrate;
+#ifdef PLANNER_BENCHMARK
+extern unsigned long planner_benchmark_time;
+extern unsigned long planner_benchmark_blocks;
+#endif
 extern unsigned long axis_steps_per_sqr_second[NUM_AXIS];
 
 extern block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion instfructions
 extern volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 extern volatile unsigned char block_buffer_tail;
+extern unsigned char raster_buffer[LASER_RASTER_BUFFER_SIZE];   // A ring buffer for the raster pixels of the planned blocks
+extern volatile unsigned int raster_buffer_head;               // Index of the next pixel to be pushed
+extern volatile unsigned int raster_buffer_tail;               // Index of the oldest pixel still in use
+// Returns the number of raster_buffer bytes holding the pixels of a block
+FORCE_INLINE unsigned int plan_raster_bytes(block_t* block)
+{
+	return block->laser_raster_packed ? (block->laser_raster_length + 7) >> 3 : block->laser_raster_length;
+}
+
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // availible for new blocks.
 FORCE_INLINE void plan_discard_current_block()
 {
 	if(block_buffer_head != block_buffer_tail)
 	{
+		block_t* block = &block_buffer[block_buffer_tail];
+		if(block->laser_raster_length != 0)
+		{
+			raster_buffer_tail = (block->laser_raster_start + plan_raster_bytes(block)) & (LASER_RASTER_BUFFER_SIZE - 1);
+		}
 		block_buffer_tail = (block_buffer_tail + 1) & (BLOCK_BUFFER_SIZE - 1);
 	}
 }
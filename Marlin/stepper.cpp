@@ -50,6 +50,10 @@ static long counter_x,       // Counter variables for the bresenham line tracer
 			counter_y;
 static long counter_l;
 static int counter_raster;
+static unsigned char raster_bits; // Packed raster pixels still to be fired, next one in the most significant bit
+#ifdef LASER_VELOCITY_POWER
+static unsigned int velocity_ocr; // CONTINUOUS mode compare value at the current step rate
+#endif
 
 volatile static unsigned long step_events_completed; // The number of step events executed in the current block
 static long acceleration_time, deceleration_time;
@@ -86,6 +90,28 @@ volatile signed char count_direction[NUM_AXIS] = { 1, 1, 1};
 
 #define CHECK_ENDSTOPS  if(check_endstops)
 
+#define ENDSTOP_X_MIN 0x01
+#define ENDSTOP_X_MAX 0x02
+#define ENDSTOP_Y_MIN 0x04
+#define ENDSTOP_Y_MAX 0x08
+static unsigned char endstops_watched; // ENDSTOP_* bits of the endstops the current block moves towards, set by block_setup()
+
+// Port-wide access for the pin groups pins.h declares as sharing a port
+#ifdef XY_STEP_DIR_SAME_PORT
+	#define XY_DIR_MASK (PIN_MASK(X_DIR_PIN) | PIN_MASK(Y_DIR_PIN))
+	#define XY_DIR_POSITIVE ((INVERT_X_DIR ? 0 : PIN_MASK(X_DIR_PIN)) | (INVERT_Y_DIR ? 0 : PIN_MASK(Y_DIR_PIN))) // direction pin levels for +X +Y
+#endif
+#ifdef X_ENDSTOPS_SAME_PORT
+	#define X_ENDSTOPS_INVERT ((X_MIN_ENDSTOP_INVERTING ? PIN_MASK(X_MIN_PIN) : 0) | (X_MAX_ENDSTOP_INVERTING ? PIN_MASK(X_MAX_PIN) : 0))
+	static unsigned char x_endstops_watched; // port bit of the X endstop the current block moves towards
+	static unsigned char old_x_endstops;
+#endif
+#ifdef Y_ENDSTOPS_SAME_PORT
+	#define Y_ENDSTOPS_INVERT ((Y_MIN_ENDSTOP_INVERTING ? PIN_MASK(Y_MIN_PIN) : 0) | (Y_MAX_ENDSTOP_INVERTING ? PIN_MASK(Y_MAX_PIN) : 0))
+	static unsigned char y_endstops_watched;
+	static unsigned char old_y_endstops;
+#endif
+
 // intRes = intIn1 * intIn2 >> 16
 // uses:
 // r26 to store 0
@@ -228,6 +254,7 @@ void enable_endstops(bool check)
 //  first block->accelerate_until step_events_completed, then keeps going at constant speed until
 //  step_events_completed reaches block->decelerate_after after which it decelerates until the trapezoid generator is reset.
 //  The slope of acceleration is calculated with the leib ramp alghorithm.
+//  With S_CURVE_ACCELERATION the slopes follow an S-curve over the same time instead, see s_curve().
 
 void st_wake_up()
 {
@@ -313,6 +340,48 @@ unsigned short calc_timer(unsigned short step_rate)
 	return timer;
 }
 
+#ifdef LASER_VELOCITY_POWER
+// Returns the step rate against the nominal rate, 8.8 fixed point, at most 1.0. The 120 steps/s floor
+// and initial_rate can exceed a low nominal_rate, but step_rate stays below max(nominal_rate, 120), so
+// the product fits in 32 bits.
+FORCE_INLINE unsigned short laser_rate_scale(unsigned short step_rate)
+{
+	return min(((unsigned long) step_rate * current_block->laser_rate_inverse) >> 16, 256UL);
+}
+#endif
+
+#ifdef S_CURVE_ACCELERATION
+// Returns delta scaled by the quintic smoothstep 10t^3 - 15t^4 + 6t^5 of time as a fraction t of the ramp,
+// so the acceleration rises from and falls back to zero instead of jumping. All in 16 bit fixed point,
+// inverse is (2^32 - 1) / ticks, so time * inverse fits in 32 bits before the end of the ramp.
+FORCE_INLINE unsigned short s_curve(unsigned long time, unsigned long ticks, unsigned long inverse, unsigned short delta)
+{
+	if(time >= ticks) { return delta; }
+	unsigned short t = (time * inverse) >> 16;
+	unsigned short t2 = ((unsigned long) t * t + 0x8000) >> 16;
+	unsigned short t3 = ((unsigned long) t2 * t + 0x8000) >> 16;
+	unsigned long p = ((10UL << 16) + 6UL * t2 - 15UL * t) >> 1;    // 6t^2 - 15t + 10, 17.15 fixed point
+	unsigned long curve = min((t3 * p) >> 15, 0x10000UL);    // Rounding can take it just past 1
+	return ((unsigned long) delta * curve) >> 16;
+}
+#endif
+
+#ifdef LASER_VELOCITY_POWER
+// Scales CONTINUOUS mode power by the step rate the same way, but never below the block's minimum power.
+// The laser is already firing, so only the PWM compare register is written.
+FORCE_INLINE void set_velocity_power(unsigned short step_rate)
+{
+	if(current_block->laser_velocity_power)
+	{
+		velocity_ocr = ((unsigned long) current_block->laser_ocr * laser_rate_scale(step_rate)) >> 8;
+		if(velocity_ocr < current_block->laser_ocr_min) { velocity_ocr = current_block->laser_ocr_min; }
+		LASER_INTENSITY_OCR = velocity_ocr;
+	}
+	else
+	{ velocity_ocr = current_block->laser_ocr; }
+}
+#endif
+
 // Initializes the trapezoid generator from the current block. Called whenever a new
 // block begins.
 FORCE_INLINE void trapezoid_generator_reset()
@@ -324,6 +393,9 @@ FORCE_INLINE void trapezoid_generator_reset()
 	acceleration_time = current_block->acceleration_time;	// calc_timer(acc_step_rate);
 	step_loops = calc_steploops(acc_step_rate);
 	OCR1A = acceleration_time;
+#ifdef LASER_VELOCITY_POWER
+	set_velocity_power(acc_step_rate);
+#endif
 
 //    SERIAL_ECHO_START;
 //    SERIAL_ECHOPGM("advance :");
@@ -337,23 +409,183 @@ FORCE_INLINE void trapezoid_generator_reset()
 
 }
 
-// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.
-// It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately.
-ISR(TIMER1_COMPA_vect)
+// Fires the next raster pixel of the current block
+FORCE_INLINE void fire_raster_pixel()
 {
-	if(laser.dur != 0 && (laser.last_firing + laser.dur < micros()))
+	if(counter_raster < (int) current_block->laser_raster_length)
 	{
+		unsigned char pixel;
+		if(current_block->laser_raster_packed)
+		{
+			// Load the next byte of packed pixels every 8 pixels
+			if((counter_raster & 7) == 0)
+			{ raster_bits = raster_buffer[(current_block->laser_raster_start + (counter_raster >> 3)) & (LASER_RASTER_BUFFER_SIZE - 1)]; }
+			pixel = (raster_bits & 0x80) ? current_block->laser_intensity : 0;
+			raster_bits <<= 1;
+		}
+		else
+		{
+			pixel = raster_buffer[(current_block->laser_raster_start + counter_raster) & (LASER_RASTER_BUFFER_SIZE - 1)];
+		}
+		laser_fire_ocr(laser_power_ocr[pixel]);    //For some reason, when comparing raster power to ppm line burns the rasters were around 2% more powerful - going from darkened paper to burning through paper.
 #if defined( LASER_DIAGNOSTICS )
-		SERIAL_ECHOLN("Laser firing duration elapsed, in interrupt handler");
+		SERIAL_ECHOPAIR("Pixel: ", (float)pixel);
+#endif
+	}
+	counter_raster++;
+}
+
+#ifdef LASER_PULSE_CLOCK
+// The pulse clock fires raster pixels and PULSED mode pulses. It is compare A of timer 5, which runs free at
+// the same 2MHz as the stepper timer. Its period is the step interval scaled by the block's steps per pulse,
+// so pulses spread evenly between steps. The stepper phase-locks it to the distance travelled: the clock may
+// only fire pulses up to pulse_limit, the pulses lying before the next step, and a pulse that is late when
+// its step is taken is fired by the stepper.
+#define ENABLE_PULSE_CLOCK()  TIMSK5 |= (1<<OCIE5A)
+#define DISABLE_PULSE_CLOCK() TIMSK5 &= ~(1<<OCIE5A)
+
+static bool pulse_clock; // The current block's pulses are fired by the pulse clock
+static unsigned int pulse_count; // Pulses fired in this block
+static unsigned int pulse_limit; // pulse_count may not pass this until the next step
+static unsigned long pulse_step_position; // Position of the current step, 24.8 fixed point
+static unsigned long pulse_next; // Position of the pulse at pulse_limit, 24.8 fixed point
+static unsigned short pulse_period; // Timer 5 ticks between pulses
+
+// Lets the pulse clock run up to the pulses lying before the next step
+FORCE_INLINE void pulse_clock_step()
+{
+	pulse_step_position += 256;
+	while(pulse_limit < current_block->laser_pulses && pulse_next < pulse_step_position)
+	{
+		pulse_limit++;
+		pulse_next += current_block->laser_steps_per_pulse;
+	}
+}
+
+// Sets the pulse clock period from the stepper timer interval, which covers step_loops steps. The steps
+// per pulse are capped at 256 to keep the multiply in 32 bits, past that the clock runs early and
+// pulse_limit holds the pulses back to their positions.
+FORCE_INLINE void pulse_clock_period(unsigned short timer)
+{
+	unsigned long steps_per_pulse = min(current_block->laser_steps_per_pulse, 0xffffUL);
+	unsigned long period = ((unsigned long) timer * steps_per_pulse) >> (8 + (step_loops >> 1));
+	if(period > 0xffff) { period = 0xffff; }
+	if(period < (F_CPU / 8 / MAX_STEP_FREQUENCY)) { period = F_CPU / 8 / MAX_STEP_FREQUENCY; }     // No faster than the stepper may step
+	pulse_period = period;
+}
+
+// Fires the next raster pixel or pulse of the current block
+FORCE_INLINE void fire_clocked_pulse()
+{
+	pulse_count++;
+	if(current_block->laser_mode == RASTER)
+	{
+		fire_raster_pixel();
+	}
+	else
+	{
+		laser_fire_ocr(current_block->laser_ocr);
+	}
+}
+
+ISR(TIMER5_COMPA_vect)
+{
+	OCR5A += pulse_period;
+	if(pulse_count < pulse_limit)
+	{
+		fire_clocked_pulse();
+	}
+}
+#endif // LASER_PULSE_CLOCK
+
+// Sets up the direction pins, the endstops to watch and the laser for the block just loaded, so the
+// stepper interrupt only has to step for the rest of the block.
+FORCE_INLINE void block_setup()
+{
+	out_bits = current_block->direction_bits;
+
+#ifdef XY_STEP_DIR_SAME_PORT
+	unsigned char dir_bits = XY_DIR_POSITIVE;
+	if((out_bits & (1<<X_AXIS)) != 0) { dir_bits ^= PIN_MASK(X_DIR_PIN); }
+	if((out_bits & (1<<Y_AXIS)) != 0) { dir_bits ^= PIN_MASK(Y_DIR_PIN); }
+	PIN_WPORT(X_DIR_PIN) = (PIN_WPORT(X_DIR_PIN) & ~XY_DIR_MASK) | dir_bits;
+	count_direction[X_AXIS] = (out_bits & (1<<X_AXIS)) ? -1 : 1;
+	count_direction[Y_AXIS] = (out_bits & (1<<Y_AXIS)) ? -1 : 1;
+#else
+	if((out_bits & (1<<X_AXIS)) !=0)
+	{
+		WRITE(X_DIR_PIN, INVERT_X_DIR);
+		count_direction[X_AXIS]=-1;
+	}
+	else
+	{
+		WRITE(X_DIR_PIN, !INVERT_X_DIR);
+		count_direction[X_AXIS]=1;
+	}
+	if((out_bits & (1<<Y_AXIS)) !=0)
+	{
+		WRITE(Y_DIR_PIN, INVERT_Y_DIR);
+		count_direction[Y_AXIS]=-1;
+	}
+	else
+	{
+		WRITE(Y_DIR_PIN, !INVERT_Y_DIR);
+		count_direction[Y_AXIS]=1;
+	}
+#endif // XY_STEP_DIR_SAME_PORT
+
+	// Only the endstops the block moves towards are read
+	endstops_watched = 0;
+	if(current_block->steps_x > 0)
+	{ endstops_watched |= (out_bits & (1<<X_AXIS)) ? ENDSTOP_X_MIN : ENDSTOP_X_MAX; }
+	if(current_block->steps_y > 0)
+	{ endstops_watched |= (out_bits & (1<<Y_AXIS)) ? ENDSTOP_Y_MIN : ENDSTOP_Y_MAX; }
+#ifdef X_ENDSTOPS_SAME_PORT
+	x_endstops_watched = (endstops_watched & ENDSTOP_X_MIN) ? PIN_MASK(X_MIN_PIN) : (endstops_watched & ENDSTOP_X_MAX) ? PIN_MASK(X_MAX_PIN) : 0;
+#endif
+#ifdef Y_ENDSTOPS_SAME_PORT
+	y_endstops_watched = (endstops_watched & ENDSTOP_Y_MIN) ? PIN_MASK(Y_MIN_PIN) : (endstops_watched & ENDSTOP_Y_MAX) ? PIN_MASK(Y_MAX_PIN) : 0;
+#endif
+
+	// Continuous firing of the laser happens here for the whole block, PPM and raster happen in the stepper interrupt.
+	// A firing duration only applies to pulses, so it would cut a continuous block short.
+	if(current_block->laser_mode == CONTINUOUS && current_block->laser_status == LASER_ON)
+	{
+		laser.dur = 0;
+#ifdef LASER_VELOCITY_POWER
+		laser_fire_ocr(velocity_ocr);
+#else
+		laser_fire_ocr(current_block->laser_ocr);
+#endif
+	}
+	if(current_block->laser_status == LASER_OFF)
+	{
+#if defined( LASER_DIAGNOSTICS )
+		SERIAL_ECHOLN("Laser status set to off, in interrupt handler");
 #endif
 		laser_extinguish();
 	}
+}
+
+// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.
+// It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately.
+ISR(TIMER1_COMPA_vect)
+{
+	laser_count_on_time();
 
 	// If there is no current block, attempt to pop one from the buffer
 	if(current_block == NULL)
 	{
 		// Anything in the buffer?
 		current_block = plan_get_current_block();
+#ifdef LASER_PERIPHERALS
+		// Hold laser blocks back until the peripherals report ready, see laser_manage_peripherals()
+		if(current_block != NULL && current_block->laser_status == LASER_ON && laser.peripherals_state != LASER_PERIPHERALS_READY)
+		{
+			current_block->busy = false;
+			current_block = NULL;
+		}
+#endif
 		if(current_block != NULL)
 		{
 			current_block->busy = true;
@@ -368,7 +600,23 @@ ISR(TIMER1_COMPA_vect)
 			{
 				counter_raster = 0;
 			}
+#ifdef LASER_PULSE_CLOCK
+			pulse_clock = current_block->laser_pulses != 0 && current_block->laser_status == LASER_ON && current_block->laser_mode != CONTINUOUS;
+			if(pulse_clock)
+			{
+				pulse_count = 0;
+				pulse_limit = 0;
+				pulse_step_position = 0;
+				pulse_next = 0;
+				pulse_clock_step();
+				pulse_clock_period(OCR1A);
+				OCR5A = TCNT5 + 4;     // Fire the first pulse straight away
+				TIFR5 = (1<<OCF5A);
+				ENABLE_PULSE_CLOCK();
+			}
+#endif
 
+			block_setup();
 		}
 		else
 		{
@@ -381,116 +629,88 @@ ISR(TIMER1_COMPA_vect)
 
 	if(current_block != NULL)
 	{
-		// Set directions TO DO This should be done once during init of trapezoid. Endstops -> interrupt STU: TODO; Move this to init of block
-		out_bits = current_block->direction_bits;
-
-		// Continuous firing of the laser during a move happens here, PPM and raster happen further down
-		if(current_block->laser_mode == CONTINUOUS && current_block->laser_status == LASER_ON)
-		{
-			laser_fire(current_block->laser_intensity);
-		}
-		if(current_block->laser_status == LASER_OFF)
-		{
-#if defined( LASER_DIAGNOSTICS )
-			SERIAL_ECHOLN("Laser status set to off, in interrupt handler");
-#endif
-			laser_extinguish();
-		}
-
-		// STU: If the direction pins were all on the same port we could simple xor the out_bits with an invert bitmask and write the whole port
-		// This would save XYZ if tests and masking the port (Assumiung the rest of the port was unused or set to input)
-
-		// STU: We could then use a lookup table to set the count directions all in one go. No if's at all
-
-		// Set the direction bits STU: TODO; Move this to init of block
-		if((out_bits & (1<<X_AXIS)) !=0)
-		{
-			WRITE(X_DIR_PIN, INVERT_X_DIR);
-			count_direction[X_AXIS]=-1;
-		}
-		else
-		{
-			WRITE(X_DIR_PIN, !INVERT_X_DIR);
-			count_direction[X_AXIS]=1;
-		}
-		if((out_bits & (1<<Y_AXIS)) !=0)
-		{
-			WRITE(Y_DIR_PIN, INVERT_Y_DIR);
-			count_direction[Y_AXIS]=-1;
-		}
-		else
-		{
-			WRITE(Y_DIR_PIN, !INVERT_Y_DIR);
-			count_direction[Y_AXIS]=1;
-		}
-
-		// Set direction en check limit switches
-
-		// STU: Why is this written like this? The if statements here mimic the ones above. They can fold into each other
-
-		// STU: If the end stops were all on the same port, we can simply read in one go all 6 end stop inputs and xor with the inverts and test for non-zero
-		// THEN do the logic of an end stop hit instead of spending all this time checking them seperately
-
 		CHECK_ENDSTOPS
 		{
-			if ((out_bits & (1 << X_AXIS)) != 0)        // stepping along -X axis
+#ifdef X_ENDSTOPS_SAME_PORT
+			if(x_endstops_watched)
 			{
+				unsigned char x_endstops = (PIN_RPORT(X_MIN_PIN) ^ X_ENDSTOPS_INVERT) & x_endstops_watched;
+				if(x_endstops & old_x_endstops)
 				{
-#if defined(X_MIN_PIN) && X_MIN_PIN > -1
-					bool x_min_endstop = (READ(X_MIN_PIN) != X_MIN_ENDSTOP_INVERTING);
-					if (x_min_endstop && old_x_min_endstop && (current_block->steps_x > 0))
-					{
-						endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
-						endstop_x_hit = true;
-						step_events_completed = current_block->step_event_count;
-					}
-					old_x_min_endstop = x_min_endstop;
-#endif
+					endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
+					endstop_x_hit = true;
+					step_events_completed = current_block->step_event_count;
 				}
+				old_x_endstops = x_endstops;
 			}
-			else   // +direction
+#else
+#if defined(X_MIN_PIN) && X_MIN_PIN > -1
+			if(endstops_watched & ENDSTOP_X_MIN)        // stepping along -X axis
 			{
+				bool x_min_endstop = (READ(X_MIN_PIN) != X_MIN_ENDSTOP_INVERTING);
+				if(x_min_endstop && old_x_min_endstop)
 				{
-#if defined(X_MAX_PIN) && X_MAX_PIN > -1
-					bool x_max_endstop= (READ(X_MAX_PIN) != X_MAX_ENDSTOP_INVERTING);
-					if(x_max_endstop && old_x_max_endstop && (current_block->steps_x > 0))
-					{
-						endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
-						endstop_x_hit=true;
-						step_events_completed = current_block->step_event_count;
-					}
-					old_x_max_endstop = x_max_endstop;
+					endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
+					endstop_x_hit = true;
+					step_events_completed = current_block->step_event_count;
+				}
+				old_x_min_endstop = x_min_endstop;
+			}
 #endif
+#if defined(X_MAX_PIN) && X_MAX_PIN > -1
+			if(endstops_watched & ENDSTOP_X_MAX)        // +direction
+			{
+				bool x_max_endstop = (READ(X_MAX_PIN) != X_MAX_ENDSTOP_INVERTING);
+				if(x_max_endstop && old_x_max_endstop)
+				{
+					endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
+					endstop_x_hit = true;
+					step_events_completed = current_block->step_event_count;
 				}
+				old_x_max_endstop = x_max_endstop;
 			}
-
-			if ((out_bits & (1 << Y_AXIS)) != 0)        // -direction
+#endif
+#endif // X_ENDSTOPS_SAME_PORT
+#ifdef Y_ENDSTOPS_SAME_PORT
+			if(y_endstops_watched)
 			{
+				unsigned char y_endstops = (PIN_RPORT(Y_MIN_PIN) ^ Y_ENDSTOPS_INVERT) & y_endstops_watched;
+				if(y_endstops & old_y_endstops)
+				{
+					endstops_trigsteps[Y_AXIS] = count_position[Y_AXIS];
+					endstop_y_hit = true;
+					step_events_completed = current_block->step_event_count;
+				}
+				old_y_endstops = y_endstops;
+			}
+#else
 #if defined(Y_MIN_PIN) && Y_MIN_PIN > -1
+			if(endstops_watched & ENDSTOP_Y_MIN)        // -direction
+			{
 				bool y_min_endstop = (READ(Y_MIN_PIN) != Y_MIN_ENDSTOP_INVERTING);
-				if (y_min_endstop && old_y_min_endstop && (current_block->steps_y > 0))
+				if(y_min_endstop && old_y_min_endstop)
 				{
 					endstops_trigsteps[Y_AXIS] = count_position[Y_AXIS];
 					endstop_y_hit = true;
 					step_events_completed = current_block->step_event_count;
 				}
 				old_y_min_endstop = y_min_endstop;
-#endif
 			}
-			else   // +direction
-			{
+#endif
 #if defined(Y_MAX_PIN) && Y_MAX_PIN > -1
-				bool y_max_endstop= (READ(Y_MAX_PIN) != Y_MAX_ENDSTOP_INVERTING);
-				if(y_max_endstop && old_y_max_endstop && (current_block->steps_y > 0))
+			if(endstops_watched & ENDSTOP_Y_MAX)        // +direction
+			{
+				bool y_max_endstop = (READ(Y_MAX_PIN) != Y_MAX_ENDSTOP_INVERTING);
+				if(y_max_endstop && old_y_max_endstop)
 				{
 					endstops_trigsteps[Y_AXIS] = count_position[Y_AXIS];
-					endstop_y_hit=true;
+					endstop_y_hit = true;
 					step_events_completed = current_block->step_event_count;
 				}
 				old_y_max_endstop = y_max_endstop;
-#endif
 			}
-
+#endif
+#endif // Y_ENDSTOPS_SAME_PORT
 		}
 
 		for(int8_t i=0; i < step_loops; i++)    // Take multiple steps per interrupt (For high speed moves)
@@ -499,6 +719,25 @@ ISR(TIMER1_COMPA_vect)
 			MSerial.checkRx(); // Check for serial chars.
 #endif
 
+#ifdef XY_STEP_DIR_SAME_PORT
+			unsigned char step_bits = 0;
+			counter_x += current_block->steps_x;
+			if(counter_x > 0) { step_bits = PIN_MASK(X_STEP_PIN); }
+			counter_y += current_block->steps_y;
+			if(counter_y > 0) { step_bits |= PIN_MASK(Y_STEP_PIN); }
+			PIN_RPORT(X_STEP_PIN) = step_bits;    // Writing ones to the input register toggles those pins, starting the step pulses
+			if(counter_x > 0)
+			{
+				counter_x -= current_block->step_event_count;
+				count_position[X_AXIS]+=count_direction[X_AXIS];
+			}
+			if(counter_y > 0)
+			{
+				counter_y -= current_block->step_event_count;
+				count_position[Y_AXIS]+=count_direction[Y_AXIS];
+			}
+			PIN_RPORT(X_STEP_PIN) = step_bits;    // and ending them
+#else
 			counter_x += current_block->steps_x;
 			if(counter_x > 0)
 			{
@@ -516,6 +755,7 @@ ISR(TIMER1_COMPA_vect)
 				count_position[Y_AXIS]+=count_direction[Y_AXIS];
 				WRITE(Y_STEP_PIN, INVERT_Y_STEP_PIN);
 			}
+#endif // XY_STEP_DIR_SAME_PORT
 
 			// steps_l = step count between laser firings
 			//
@@ -524,7 +764,7 @@ ISR(TIMER1_COMPA_vect)
 			{
 				if(current_block->laser_mode == PULSED && current_block->laser_status == LASER_ON)    // Pulsed Firing Mode
 				{
-					laser_fire(current_block->laser_intensity);
+					laser_fire_ocr(current_block->laser_ocr);
 #if defined( LASER_DIAGNOSTICS )
 					SERIAL_ECHOPAIR("X: ", counter_x);
 					SERIAL_ECHOPAIR("Y: ", counter_y);
@@ -534,22 +774,18 @@ ISR(TIMER1_COMPA_vect)
 
 				if(current_block->laser_mode == RASTER && current_block->laser_status == LASER_ON)    // Raster Firing Mode
 				{
-					laser_fire(current_block->laser_raster_data[counter_raster]);    //For some reason, when comparing raster power to ppm line burns the rasters were around 2% more powerful - going from darkened paper to burning through paper.
-#if defined( LASER_DIAGNOSTICS )
-					SERIAL_ECHOPAIR("Pixel: ", (float)current_block->laser_raster_data[counter_raster]);
-#endif
-					counter_raster++;
+					fire_raster_pixel();
 				}
 
 				counter_l -= current_block->step_event_count;
 			}
-			if(current_block->laser_duration != 0 && (laser.last_firing + current_block->laser_duration < micros()))
+#ifdef LASER_PULSE_CLOCK
+			if(pulse_clock)
 			{
-#if defined( LASER_DIAGNOSTICS )
-				SERIAL_ECHOLN("Laser firing duration elapsed, in interrupt fast loop");
-#endif
-				laser_extinguish();
+				if(pulse_count < pulse_limit) { fire_clocked_pulse(); }
+				pulse_clock_step();
 			}
+#endif
 
 			step_events_completed += 1;
 			if(step_events_completed >= current_block->step_event_count) { break; }
@@ -561,8 +797,13 @@ ISR(TIMER1_COMPA_vect)
 		if(step_events_completed <= (unsigned long int) current_block->accelerate_until)      // Accelerate!
 		{
 
+#ifdef S_CURVE_ACCELERATION
+			acc_step_rate = current_block->initial_rate + s_curve(acceleration_time, current_block->acceleration_ticks,
+			                current_block->acceleration_inverse, current_block->cruise_rate - current_block->initial_rate);
+#else
 			MultiU24X24toH16(acc_step_rate, acceleration_time, current_block->acceleration_rate);
 			acc_step_rate += current_block->initial_rate;
+#endif
 
 			// upper limit
 			if(acc_step_rate > current_block->nominal_rate)
@@ -572,10 +813,18 @@ ISR(TIMER1_COMPA_vect)
 			timer = calc_timer(acc_step_rate);
 			OCR1A = timer;
 			acceleration_time += timer;
+#ifdef LASER_VELOCITY_POWER
+			set_velocity_power(acc_step_rate);
+#endif
 		}
 		else if(step_events_completed > (unsigned long int) current_block->decelerate_after)      // Decelerate!
 		{
+#ifdef S_CURVE_ACCELERATION
+			step_rate = (acc_step_rate > current_block->final_rate) ? s_curve(deceleration_time, current_block->deceleration_ticks,
+			            current_block->deceleration_inverse, acc_step_rate - current_block->final_rate) : 0;
+#else
 			MultiU24X24toH16(step_rate, deceleration_time, current_block->acceleration_rate);
+#endif
 
 			if(step_rate > acc_step_rate)    // Check step_rate stays positive
 			{
@@ -594,17 +843,34 @@ ISR(TIMER1_COMPA_vect)
 			timer = calc_timer(step_rate);
 			OCR1A = timer;
 			deceleration_time += timer;
+#ifdef LASER_VELOCITY_POWER
+			set_velocity_power(step_rate);
+#endif
 		}
 		else   // Stay the same (nominal) speed!
 		{
 			OCR1A = OCR1A_nominal;
 			// ensure we're running at the correct step rate, even if we just came off an acceleration
 			step_loops = step_loops_nominal;
+#ifdef LASER_VELOCITY_POWER
+			if(velocity_ocr != current_block->laser_ocr)
+			{
+				velocity_ocr = current_block->laser_ocr;
+				LASER_INTENSITY_OCR = velocity_ocr;
+			}
+#endif
 		}
+#ifdef LASER_PULSE_CLOCK
+		if(pulse_clock) { pulse_clock_period(OCR1A); }
+#endif
 
 		// If current block is finished, reset pointer
 		if(step_events_completed >= current_block->step_event_count)
 		{
+#ifdef LASER_PULSE_CLOCK
+			DISABLE_PULSE_CLOCK();
+			pulse_clock = false;
+#endif
 			current_block = NULL;
 			plan_discard_current_block();
 			laser_extinguish();
@@ -728,6 +994,10 @@ void st_init()
 	TCNT1 = 0;
 	ENABLE_STEPPER_DRIVER_INTERRUPT();
 
+#ifdef LASER_PULSE_CLOCK
+	DISABLE_PULSE_CLOCK();    // Enabled per pulsed or raster block, timer 5 itself is started by laser_init()
+#endif
+
 	enable_endstops(true);    // Start with endstops active. After homing they can be disabled
 	sei();
 }
@@ -777,6 +1047,10 @@ void finishAndDisableSteppers()
 void quickStop()
 {
 	DISABLE_STEPPER_DRIVER_INTERRUPT();
+#ifdef LASER_PULSE_CLOCK
+	DISABLE_PULSE_CLOCK();
+	pulse_clock = false;
+#endif
 	while(blocks_queued())
 	{ plan_discard_current_block(); }
 	current_block = NULL;